@@ -0,0 +1,160 @@
+#ifndef __H_AOV_H__
+#define __H_AOV_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Intersection.h"
+
+using namespace std;
+using namespace glm;
+
+/* Arbitrary output variables: what the camera rays hit first, per pixel, for
+compositing and denoising. Depth, normal and albedo are summed over the
+samples and averaged on reading, so they are anti-aliased like the image.
+The primitive (index in the scene), face (of a mesh, -1 otherwise) and
+material are those of the pixel's first sample that hit anything; -1 where
+none did.
+
+Each variable is a plane of its own, row by row. Like the accumulation
+buffer, a pixel must only be written by the worker that owns its tile, and
+only read between passes. */
+class AOVBuffer {
+public:
+    int width, height;
+
+    vector<float> depth, normal[3], albedo[3];
+    vector<int> samples;
+    vector<int32_t> primitive, face, material;
+
+    AOVBuffer(int width, int height) : width(width), height(height) {
+        Clear();
+    }
+
+    void Clear() {
+        int n = width * height;
+        depth.assign(n, 0);
+        for (int c = 0; c < 3; c++) {
+            normal[c].assign(n, 0);
+            albedo[c].assign(n, 0);
+        }
+        samples.assign(n, 0);
+        primitive.assign(n, -1);
+        face.assign(n, -1);
+        material.assign(n, -1);
+    }
+
+    /* Adds a sample of pixel (x, y) whose camera ray first hit `hit`, at
+    `distance` from the camera */
+    void Add(int x, int y, const Intersection& hit, float distance) {
+        int i = y * width + x;
+        const vec3& diffuse = hit.GetMaterial().diffuse;
+        for (int c = 0; c < 3; c++) {
+            normal[c][i] += hit.normal[c];
+            albedo[c][i] += diffuse[c];
+        }
+        depth[i] += distance;
+        samples[i]++;
+
+        if (primitive[i] < 0) {
+            primitive[i] = hit.primitiveIndex;
+            face[i] = hit.faceIndex;
+            material[i] = hit.materialId;
+        }
+    }
+
+    /* Adds a sample of pixel (x, y) that hit nothing; it counts as black at
+    depth 0 */
+    void AddMiss(int x, int y) {
+        samples[y * width + x]++;
+    }
+
+    float Depth(int i) const {
+        return samples[i] > 0 ? depth[i] / samples[i] : 0.f;
+    }
+
+    vec3 Normal(int i) const {
+        return Average(normal, i);
+    }
+
+    vec3 Albedo(int i) const {
+        return Average(albedo, i);
+    }
+
+    /* Writes every variable as a PFM image named prefix_<variable>.pfm, IDs
+    as floats. Returns false if a file could not be written. */
+    bool Save(const string& prefix) const {
+        int n = width * height;
+        vector<float> plane[3];
+        for (int c = 0; c < 3; c++) {
+            plane[c].resize(n);
+        }
+
+        for (int i = 0; i < n; i++) {
+            plane[0][i] = Depth(i);
+        }
+        bool ok = Write(prefix + "_depth.pfm", plane, 1);
+
+        for (int i = 0; i < n; i++) {
+            vec3 v = Normal(i);
+            for (int c = 0; c < 3; c++) {
+                plane[c][i] = v[c];
+            }
+        }
+        ok = Write(prefix + "_normal.pfm", plane, 3) && ok;
+
+        for (int i = 0; i < n; i++) {
+            vec3 v = Albedo(i);
+            for (int c = 0; c < 3; c++) {
+                plane[c][i] = v[c];
+            }
+        }
+        ok = Write(prefix + "_albedo.pfm", plane, 3) && ok;
+
+        const vector<int32_t>* ids[3] = { &primitive, &face, &material };
+        const char* names[3] = { "_primitive.pfm", "_face.pfm", "_material.pfm" };
+        for (int k = 0; k < 3; k++) {
+            for (int i = 0; i < n; i++) {
+                plane[0][i] = (float) (*ids[k])[i];
+            }
+            ok = Write(prefix + names[k], plane, 1) && ok;
+        }
+        return ok;
+    }
+
+private:
+    vec3 Average(const vector<float> sum[3], int i) const {
+        if (samples[i] == 0) {
+            return vec3(0, 0, 0);
+        }
+        return vec3(sum[0][i], sum[1][i], sum[2][i]) / (float) samples[i];
+    }
+
+    /* PFM with 1 or 3 channels from as many planes. The negative scale marks
+    the floats as little-endian, which is assumed to be the machine's order;
+    rows go from the bottom of the image up. */
+    bool Write(const string& filename, const vector<float> planes[3], int channels) const {
+        FILE* f = fopen(filename.c_str(), "wb");
+        if (f == NULL) {
+            return false;
+        }
+
+        bool ok = fprintf(f, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height) > 0;
+        vector<float> row(width * channels);
+        for (int y = height - 1; ok && y >= 0; y--) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < channels; c++) {
+                    row[x * channels + c] = planes[c][y * width + x];
+                }
+            }
+            ok = fwrite(row.data(), sizeof(float), row.size(), f) == row.size();
+        }
+
+        return fclose(f) == 0 && ok;
+    }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef __H_ACCUMULATIONBUFFER_H__
+#define __H_ACCUMULATIONBUFFER_H__
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <SDL.h>
+
+using namespace std;
+using namespace glm;
+
+/* HDR accumulation buffer for progressive rendering. The frame is split into
+tiles and each tile is only ever written by the worker that owns it, so adding
+samples needs no locks. A worker renders a whole pass into its own scratch
+buffer and then commits it in one go; every tile carries a sequence counter
+(odd while a commit is in progress) that lets the display thread take a
+consistent snapshot of a tile while the workers keep rendering. */
+class AccumulationBuffer {
+public:
+    /* Summed radiance and number of samples of one pixel */
+    struct Texel {
+        vec3 color;
+        int count;
+
+        vec3 Resolve() const {
+            return count > 0 ? color / (float) count : vec3(0, 0, 0);
+        }
+    };
+
+    int tilesX, tilesY;
+
+    AccumulationBuffer(int tilesX, int tilesY)
+    : tilesX(tilesX), tilesY(tilesY), versions(new atomic<unsigned>[tilesX * tilesY]) {
+        Clear();
+    }
+
+    int NumTiles() const {
+        return tilesX * tilesY;
+    }
+
+    /* Pixel range [x1, x2) x [y1, y2) covered by a tile */
+    void TileBounds(int tile, int& x1, int& y1, int& x2, int& y2) const {
+        y1 = (tile / tilesX) * SCREEN_HEIGHT / tilesY;
+        y2 = (tile / tilesX + 1) * SCREEN_HEIGHT / tilesY;
+        x1 = (tile % tilesX) * SCREEN_WIDTH / tilesX;
+        x2 = (tile % tilesX + 1) * SCREEN_WIDTH / tilesX;
+    }
+
+    /* Not thread safe, only call while no worker is rendering */
+    void Clear() {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                texels[y][x].color = vec3(0, 0, 0);
+                texels[y][x].count = 0;
+            }
+        }
+        for (int i = 0; i < NumTiles(); i++) {
+            versions[i].store(0);
+        }
+    }
+
+    /* Copies all texels, row by row, to `out`. Not thread safe, only call
+    while no worker is rendering. */
+    void Save(Texel* out) const {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                *out++ = texels[y][x];
+            }
+        }
+    }
+
+    /* Replaces all texels with ones saved by Save(). Each tile's version is
+    set to its number of samples. Not thread safe either. */
+    void Load(const Texel* in) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                texels[y][x] = *in++;
+            }
+        }
+        for (int i = 0; i < NumTiles(); i++) {
+            int x1, y1, x2, y2;
+            TileBounds(i, x1, y1, x2, y2);
+            versions[i].store(2 * texels[y1][x1].count);
+        }
+    }
+
+    /* Adds one sample to every pixel of the tile. `pass` holds the tile's
+    pixels row by row. Must only be called by the tile's owner. */
+    void Commit(int tile, const vector<vec3>& pass) {
+        int x1, y1, x2, y2;
+        TileBounds(tile, x1, y1, x2, y2);
+
+        unsigned version = versions[tile].load(memory_order_relaxed);
+        versions[tile].store(version + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        int i = 0;
+        for (int y = y1; y < y2; y++) {
+            for (int x = x1; x < x2; x++) {
+                texels[y][x].color += pass[i++];
+                texels[y][x].count++;
+            }
+        }
+
+        versions[tile].store(version + 2, memory_order_release);
+    }
+
+    /* Resolves n texels and packs them as 8-bit RGB pixels of the given
+    format. Written with plain selects rather than calls so that the compiler turns the
+    loop into SIMD code; empty texels come out black because their color is
+    zero. */
+    static void ResolveRow(
+        const Texel* texels, int n, Uint32* pixels, const SDL_PixelFormat* format
+    ) {
+        const float* t = (const float*) texels;
+        const int* count = (const int*) texels;
+        int rShift = format->Rshift, gShift = format->Gshift, bShift = format->Bshift;
+
+        for (int i = 0; i < n; i++) {
+            int c = count[i * 4 + 3];
+            float scale = 255.f / (float) (c > 1 ? c : 1);
+            float r = t[i * 4 + 0] * scale;
+            float g = t[i * 4 + 1] * scale;
+            float b = t[i * 4 + 2] * scale;
+            r = r > 0.f ? (r < 255.f ? r : 255.f) : 0.f;
+            g = g > 0.f ? (g < 255.f ? g : 255.f) : 0.f;
+            b = b > 0.f ? (b < 255.f ? b : 255.f) : 0.f;
+            pixels[i] =
+                ((Uint32) (int) r << rShift) |
+                ((Uint32) (int) g << gShift) |
+                ((Uint32) (int) b << bShift);
+        }
+    }
+
+    /* Number of commits made to the tile so far */
+    unsigned Version(int tile) const {
+        return versions[tile].load(memory_order_acquire) / 2;
+    }
+
+    /* Copies the tile into `snapshot` such that it reflects a whole number of
+    commits, retrying if the owner commits while copying. Returns the number
+    of commits contained in the snapshot. */
+    unsigned Snapshot(
+        int tile, Texel (&snapshot)[SCREEN_HEIGHT][SCREEN_WIDTH]
+    ) const {
+        int x1, y1, x2, y2;
+        TileBounds(tile, x1, y1, x2, y2);
+
+        unsigned before, after;
+        do {
+            before = versions[tile].load(memory_order_acquire);
+            if (before & 1) {
+                this_thread::yield();
+                continue;
+            }
+
+            for (int y = y1; y < y2; y++) {
+                for (int x = x1; x < x2; x++) {
+                    snapshot[y][x] = texels[y][x];
+                }
+            }
+
+            atomic_thread_fence(memory_order_acquire);
+            after = versions[tile].load(memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        return before / 2;
+    }
+
+private:
+    Texel texels[SCREEN_HEIGHT][SCREEN_WIDTH];
+    unique_ptr<atomic<unsigned>[]> versions;
+};
+
+#endif
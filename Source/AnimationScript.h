@@ -0,0 +1,98 @@
+#ifndef __H_ANIMATIONSCRIPT_H__
+#define __H_ANIMATIONSCRIPT_H__
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+/* Sequence of frames to render in one run. The script is a text file of
+commands, one per line, that change the state of the scene; `frame` renders
+the current state:
+
+    # comment
+    passes 64               samples per pixel of the following frames
+    camera x y z yaw pitch  camera position and angles (radians)
+    move i x y z            moves object i (a ball, or a copy of the model,
+                            in the order they were added) to x y z
+    frame                   renders a frame
+
+State carries over from frame to frame, so a frame only lists what changed
+since the previous one. */
+class AnimationScript {
+public:
+    struct Move {
+        int object;
+        vec3 position;
+    };
+
+    struct Frame {
+        vec3 cameraPosition;
+        float yaw, pitch;
+        int passes;
+        vector<Move> moves;     // since the previous frame
+    };
+
+    vector<Frame> frames;
+
+    /* Reads the script. `camera` and `passes` give the state before the
+    first command; passes are capped at maxPasses. */
+    bool Load(
+        const char* filename, vec3 cameraPosition, float yaw, float pitch,
+        int passes, int maxPasses
+    ) {
+        ifstream file(filename);
+        if (!file) {
+            cout << "Could not open " << filename << endl;
+            return false;
+        }
+
+        Frame state;
+        state.cameraPosition = cameraPosition;
+        state.yaw = yaw;
+        state.pitch = pitch;
+        state.passes = passes;
+
+        string line;
+        for (int number = 1; getline(file, line); number++) {
+            istringstream words(line);
+            string command;
+            if (!(words >> command) || command[0] == '#') {
+                continue;
+            }
+
+            bool ok;
+            if (command == "passes") {
+                ok = (bool) (words >> state.passes) && state.passes > 0;
+                state.passes = std::min(state.passes, maxPasses);
+            } else if (command == "camera") {
+                vec3& p = state.cameraPosition;
+                ok = (bool) (words >> p.x >> p.y >> p.z >> state.yaw >> state.pitch);
+            } else if (command == "move") {
+                Move move;
+                vec3& p = move.position;
+                ok = (bool) (words >> move.object >> p.x >> p.y >> p.z) && move.object >= 0;
+                state.moves.push_back(move);
+            } else if (command == "frame") {
+                frames.push_back(state);
+                state.moves.clear();
+                ok = true;
+            } else {
+                ok = false;
+            }
+
+            if (!ok) {
+                cout << filename << ":" << number << ": could not read \"" << line << "\"" << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
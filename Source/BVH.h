@@ -0,0 +1,717 @@
+#ifndef __H_BVH_H__
+#define __H_BVH_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Buffer.h"
+
+using namespace std;
+using namespace glm;
+
+/* Node of a bounding volume hierarchy. Leaves cover `count` consecutive
+items starting at `start`; inner nodes have count 0 and their two children
+at `start` and `start + 1`. 32 bytes, so two nodes share a cache line. */
+struct BVHNode {
+    vec3 min;
+    int start;
+    vec3 max;
+    int count;
+
+    bool IsLeaf() const {
+        return count > 0;
+    }
+};
+
+/* Compressed node with up to four children, exactly one cache line. The
+children's boxes are stored as 8-bit offsets on a grid spanning the node's
+own box, rounded outwards so they never shrink. Each child reference is
+either EMPTY, another node, or a leaf packed as LEAF | start << 4 |
+(count - 1), which limits a hierarchy to 2^27 items; see BVH::MAX_ITEMS. */
+struct BVHWideNode {
+    enum : uint32_t {
+        EMPTY = 0xFFFFFFFF,
+        LEAF = 0x80000000
+    };
+
+    vec3 origin;
+    vec3 scale;             // size of one grid step on each axis
+    uint8_t lo[3][4];       // [axis][child], so one axis of all children is one load
+    uint8_t hi[3][4];
+    uint32_t child[4];
+
+    vec3 ChildMin(int c) const {
+        return origin + vec3(lo[0][c], lo[1][c], lo[2][c]) * scale;
+    }
+
+    vec3 ChildMax(int c) const {
+        return origin + vec3(hi[0][c], hi[1][c], hi[2][c]) * scale;
+    }
+};
+
+/* The layout the hierarchy is stored and traversed in; `make BVH_COMPRESSED=1`
+selects the wide nodes, which take a bit more work per node but about half
+the memory */
+#ifdef BVH_COMPRESSED
+typedef BVHWideNode BVHStoredNode;
+#else
+typedef BVHNode BVHStoredNode;
+#endif
+
+/* Bounding volume hierarchy over a set of boxes, built with the surface area
+heuristic. The BVH does not know what the boxes belong to: Build() returns
+the order the caller has to store its items in, so that every leaf refers to
+a contiguous range of them. */
+class BVH {
+public:
+    Buffer<BVHStoredNode> nodes;
+
+    /* Most items a hierarchy can be built over: what the packed leaf
+    reference of a wide node can address, or for binary nodes what keeps
+    the 2n - 1 node indices within an int */
+#ifdef BVH_COMPRESSED
+    static const int MAX_ITEMS = 1 << 27;
+#else
+    static const int MAX_ITEMS = numeric_limits<int>::max() / 2;
+#endif
+
+    /* Builds the hierarchy over the boxes [lo[i], hi[i]] and fills `order`
+    with the box indices in leaf order. Returns false, leaving the hierarchy
+    empty, if there are more than MAX_ITEMS boxes. */
+    bool Build(const vector<vec3>& lo, const vector<vec3>& hi, vector<int>& order) {
+        nodes.clear();
+        if (lo.size() > (size_t) MAX_ITEMS) {
+            return false;
+        }
+        int n = lo.size();
+        order.resize(n);
+        for (int i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        if (n == 0) {
+            return true;
+        }
+
+        vector<vec3> centroids(n);
+        for (int i = 0; i < n; i++) {
+            centroids[i] = (lo[i] + hi[i]) * 0.5f;
+        }
+
+        vector<BVHNode> tree;
+        tree.reserve(2 * n);
+        BVHNode root;
+        root.start = 0;
+        root.count = n;
+        tree.push_back(root);
+        Subdivide(tree, 0, 0, lo, hi, centroids, order);
+
+#ifdef BVH_COMPRESSED
+        Compress(tree);
+#else
+        nodes.resize(tree.size());
+        copy(tree.begin(), tree.end(), nodes.begin());
+#endif
+        return true;
+    }
+
+    bool Empty() const {
+        return nodes.empty();
+    }
+
+    /* Bytes taken by the nodes */
+    size_t Memory() const {
+        return nodes.size() * sizeof(BVHStoredNode);
+    }
+
+    /* Box around everything in the hierarchy */
+    void Bounds(vec3& lo, vec3& hi) const {
+#ifdef BVH_COMPRESSED
+        lo = nodes[0].origin;
+        hi = nodes[0].origin + 255.f * nodes[0].scale;
+#else
+        lo = nodes[0].min;
+        hi = nodes[0].max;
+#endif
+    }
+
+    /* Updates the boxes bottom-up after items moved, keeping the structure.
+    lo/hi are the items' current boxes in leaf order, i.e. indexed like the
+    caller's reordered items rather than like the boxes given to Build(). The
+    tree gets slower to traverse as the items drift from where they were
+    when it was built; Cost() tells by how much. */
+    void Refit(const vector<vec3>& lo, const vector<vec3>& hi) {
+        if (nodes.empty()) {
+            return;
+        }
+#ifdef BVH_COMPRESSED
+        vec3 min, max;
+        RefitWide(0, lo, hi, min, max);
+#else
+        // Children are always stored after their parent
+        for (int i = nodes.size() - 1; i >= 0; i--) {
+            BVHNode& n = nodes[i];
+            Bin bounds;
+            if (n.IsLeaf()) {
+                for (int j = n.start; j < n.start + n.count; j++) {
+                    bounds.Grow(lo[j], hi[j]);
+                }
+            } else {
+                bounds.Grow(nodes[n.start].min, nodes[n.start].max);
+                bounds.Grow(nodes[n.start + 1].min, nodes[n.start + 1].max);
+            }
+            n.min = bounds.min;
+            n.max = bounds.max;
+        }
+#endif
+    }
+
+    /* Whether traversal can walk the nodes safely: every child is stored
+    after its parent, leaves only cover items below numItems, and no inner
+    node is deeper than Build() puts one, so the traversal stacks can not
+    overflow. For hierarchies read back from a file. */
+    bool Valid(size_t numItems) const {
+        vector<int> depth(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size(); i++) {
+#ifdef BVH_COMPRESSED
+            if (depth[i] >= MAX_DEPTH) {
+                return false;
+            }
+            for (int c = 0; c < 4; c++) {
+                uint32_t ref = nodes[i].child[c];
+                if (ref == BVHWideNode::EMPTY) {
+                    continue;
+                }
+                if (ref & BVHWideNode::LEAF) {
+                    size_t start = (ref & ~BVHWideNode::LEAF) >> 4;
+                    if (start + (ref & 15) + 1 > numItems) {
+                        return false;
+                    }
+                } else if (ref <= i || ref >= nodes.size()) {
+                    return false;
+                } else {
+                    depth[ref] = std::max(depth[ref], depth[i] + 1);
+                }
+            }
+#else
+            const BVHNode& n = nodes[i];
+            if (n.start < 0 || n.count < 0) {
+                return false;
+            }
+            if (n.IsLeaf()) {
+                if ((size_t) n.start + n.count > numItems) {
+                    return false;
+                }
+            } else {
+                size_t child = n.start;
+                if (child <= i || child + 1 >= nodes.size() || depth[i] >= MAX_DEPTH) {
+                    return false;
+                }
+                depth[child] = std::max(depth[child], depth[i] + 1);
+                depth[child + 1] = std::max(depth[child + 1], depth[i] + 1);
+            }
+#endif
+        }
+        return true;
+    }
+
+    /* Expected cost of tracing a ray through the hierarchy under the surface
+    area heuristic, in units of one item test for a ray that hits the root */
+    float Cost() const {
+        if (nodes.empty()) {
+            return 0;
+        }
+        vec3 min, max;
+        Bounds(min, max);
+        float rootArea = Area(min, max);
+        if (rootArea <= 0) {
+            return 0;
+        }
+
+        float cost = TRAVERSE_COST * rootArea;
+#ifdef BVH_COMPRESSED
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const BVHWideNode& n = nodes[i];
+            for (int c = 0; c < 4; c++) {
+                if (n.child[c] == BVHWideNode::EMPTY) {
+                    continue;
+                }
+                float area = Area(n.ChildMin(c), n.ChildMax(c));
+                if (n.child[c] & BVHWideNode::LEAF) {
+                    cost += INTERSECT_COST * area * ((n.child[c] & 15) + 1);
+                } else {
+                    cost += TRAVERSE_COST * area;
+                }
+            }
+        }
+#else
+        for (size_t i = 1; i < nodes.size(); i++) {
+            const BVHNode& n = nodes[i];
+            float area = Area(n.min, n.max);
+            cost += n.IsLeaf() ? INTERSECT_COST * area * n.count : TRAVERSE_COST * area;
+        }
+        if (nodes[0].IsLeaf()) {
+            cost += INTERSECT_COST * rootArea * nodes[0].count;
+        }
+#endif
+        return cost / rootArea;
+    }
+
+    /* Calls visit(i) for the items of every leaf the ray enters before
+    `closest`, nearest leaves first. `closest` is reread at every node, so
+    the visitor shrinking it prunes the rest of the walk. */
+    template <typename Visit>
+    void Traverse(const vec3& s, const vec3& d, const float& closest, Visit visit) const {
+        Traverse(s, d, closest, visit, [](const void*) {});
+    }
+
+    /* As above, also calling touch(node) for every node whose children are
+    read */
+    template <typename Visit, typename Touch>
+    void Traverse(
+        const vec3& s, const vec3& d, const float& closest, Visit visit, Touch touch
+    ) const {
+        if (nodes.empty()) {
+            return;
+        }
+#ifdef BVH_COMPRESSED
+        TraverseWide(s, d, closest, visit, touch);
+#else
+        TraverseBinary(s, d, closest, visit, touch);
+#endif
+    }
+
+    /* Slab test. `invD` is 1 / ray direction. Returns true if the ray enters
+    the box before `closest`, setting `tNear` to the entry distance. */
+    static bool IntersectBox(
+        const vec3& s, const vec3& invD, const vec3& min, const vec3& max,
+        float closest, float& tNear
+    ) {
+        vec3 t1 = (min - s) * invD;
+        vec3 t2 = (max - s) * invD;
+        vec3 tMin = glm::min(t1, t2);
+        vec3 tMax = glm::max(t1, t2);
+        float enter = std::max(std::max(tMin.x, tMin.y), tMin.z);
+        float exit = std::min(std::min(tMax.x, tMax.y), tMax.z);
+        tNear = enter;
+        return enter <= exit && exit > 0 && enter < closest;
+    }
+
+    static vec3 Inverse(const vec3& d) {
+        // Division by zero gives infinities of the right sign, which the
+        // slab test handles
+        return vec3(1.f / d.x, 1.f / d.y, 1.f / d.z);
+    }
+
+private:
+    static const int BINS = 12;
+    static const int MAX_LEAF_SIZE = 4;
+
+    // Larger leaves are split even when the SAH prefers not to, so that a
+    // leaf's size fits the wide node's child reference
+    static const int MAX_LEAF_COUNT = 16;
+
+    // Leaves are never deeper than this, which bounds the traversal stacks.
+    // Below the depth where the SAH could run out of room, nodes are split
+    // at the median instead, so any item count still fits.
+    static const int MAX_DEPTH = 40;
+
+    static constexpr float TRAVERSE_COST = 1.f;
+    static constexpr float INTERSECT_COST = 1.f;
+
+    static float Area(const vec3& min, const vec3& max) {
+        vec3 e = max - min;
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    struct Bin {
+        vec3 min, max;
+        int count;
+
+        Bin() : min(numeric_limits<float>::max()),
+            max(-numeric_limits<float>::max()), count(0) {}
+
+        void Grow(const vec3& lo, const vec3& hi) {
+            min = glm::min(min, lo);
+            max = glm::max(max, hi);
+        }
+    };
+
+    template <typename Visit, typename Touch>
+    void TraverseBinary(
+        const vec3& s, const vec3& d, const float& closest, Visit& visit, Touch& touch
+    ) const {
+        const BVHNode* node = (const BVHNode*) nodes.data();
+        vec3 invD = Inverse(d);
+        int stack[MAX_DEPTH + 1];
+        int top = 0;
+        float tNear;
+
+        touch(&node[0]);
+        if (IntersectBox(s, invD, node[0].min, node[0].max, closest, tNear)) {
+            stack[top++] = 0;
+        }
+
+        while (top > 0) {
+            const BVHNode& n = node[stack[--top]];
+
+            if (n.IsLeaf()) {
+                for (int i = n.start; i < n.start + n.count; i++) {
+                    visit(i);
+                }
+                continue;
+            }
+
+            float tLeft, tRight;
+            int left = n.start, right = n.start + 1;
+            touch(&node[left]);
+            bool hitLeft = IntersectBox(s, invD, node[left].min, node[left].max, closest, tLeft);
+            bool hitRight = IntersectBox(s, invD, node[right].min, node[right].max, closest, tRight);
+
+            // Push the farther child first so the nearer one is visited next
+            if (hitLeft && hitRight) {
+                if (tLeft < tRight) {
+                    stack[top++] = right;
+                    stack[top++] = left;
+                } else {
+                    stack[top++] = left;
+                    stack[top++] = right;
+                }
+            } else if (hitLeft) {
+                stack[top++] = left;
+            } else if (hitRight) {
+                stack[top++] = right;
+            }
+        }
+    }
+
+    template <typename Visit, typename Touch>
+    void TraverseWide(
+        const vec3& s, const vec3& d, const float& closest, Visit& visit, Touch& touch
+    ) const {
+        const BVHWideNode* node = (const BVHWideNode*) nodes.data();
+        vec3 invD = Inverse(d);
+        // Every wide level spans at least one binary level and leaves up to
+        // three siblings on the stack
+        uint32_t stack[3 * MAX_DEPTH + 1];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            uint32_t ref = stack[--top];
+
+            if (ref & BVHWideNode::LEAF) {
+                int start = (ref & ~BVHWideNode::LEAF) >> 4;
+                int count = (ref & 15) + 1;
+                for (int i = start; i < start + count; i++) {
+                    visit(i);
+                }
+                continue;
+            }
+
+            // Test all children, then push the hits far to near
+            const BVHWideNode& n = node[ref];
+            touch(&n);
+            uint32_t hits[4];
+            float t[4];
+            int numHits = 0;
+            for (int c = 0; c < 4; c++) {
+                float tNear;
+                if (n.child[c] != BVHWideNode::EMPTY &&
+                    IntersectBox(s, invD, n.ChildMin(c), n.ChildMax(c), closest, tNear)) {
+                    int j = numHits++;
+                    while (j > 0 && t[j - 1] < tNear) {
+                        t[j] = t[j - 1];
+                        hits[j] = hits[j - 1];
+                        j--;
+                    }
+                    t[j] = tNear;
+                    hits[j] = n.child[c];
+                }
+            }
+            for (int i = 0; i < numHits; i++) {
+                stack[top++] = hits[i];
+            }
+        }
+    }
+
+    /* Levels of median splits needed to get `count` items into leaves */
+    static int MedianLevels(int count) {
+        int levels = 0;
+        while (count > MAX_LEAF_COUNT) {
+            count = (count + 1) / 2;
+            levels++;
+        }
+        return levels;
+    }
+
+    void Subdivide(
+        vector<BVHNode>& tree, int index, int depth, const vector<vec3>& lo,
+        const vector<vec3>& hi, const vector<vec3>& centroids, vector<int>& order
+    ) {
+        int start = tree[index].start;
+        int count = tree[index].count;
+
+        // Bounds of the node and of its centroids
+        Bin bounds, centroidBounds;
+        for (int i = start; i < start + count; i++) {
+            bounds.Grow(lo[order[i]], hi[order[i]]);
+            centroidBounds.Grow(centroids[order[i]], centroids[order[i]]);
+        }
+        tree[index].min = bounds.min;
+        tree[index].max = bounds.max;
+
+        if (count <= MAX_LEAF_SIZE) {
+            return;
+        }
+
+        // Find the cheapest split among the bin boundaries of all axes
+        float bestCost = numeric_limits<float>::max();
+        int bestAxis = -1, bestSplit = 0;
+        vec3 extent = centroidBounds.max - centroidBounds.min;
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0) {
+                continue;
+            }
+
+            Bin bins[BINS];
+            float scale = BINS / extent[axis];
+            for (int i = start; i < start + count; i++) {
+                int b = std::min(BINS - 1,
+                    (int) ((centroids[order[i]][axis] - centroidBounds.min[axis]) * scale));
+                bins[b].Grow(lo[order[i]], hi[order[i]]);
+                bins[b].count++;
+            }
+
+            // Sweep from the right, then from the left
+            float rightArea[BINS - 1];
+            int rightCount[BINS - 1];
+            Bin right;
+            int n = 0;
+            for (int b = BINS - 1; b > 0; b--) {
+                right.Grow(bins[b].min, bins[b].max);
+                n += bins[b].count;
+                rightArea[b - 1] = n > 0 ? Area(right.min, right.max) : 0;
+                rightCount[b - 1] = n;
+            }
+
+            Bin left;
+            n = 0;
+            for (int b = 0; b < BINS - 1; b++) {
+                left.Grow(bins[b].min, bins[b].max);
+                n += bins[b].count;
+                if (n == 0 || rightCount[b] == 0) {
+                    continue;
+                }
+                float cost = Area(left.min, left.max) * n + rightArea[b] * rightCount[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        // Only split if that is cheaper than testing every item
+        float leafCost = Area(bounds.min, bounds.max) * count * INTERSECT_COST;
+        bool split = bestAxis >= 0 &&
+            TRAVERSE_COST * Area(bounds.min, bounds.max) + bestCost * INTERSECT_COST < leafCost;
+
+        // An SAH split may leave a child with all but one item, which must
+        // still fit below MAX_DEPTH
+        bool deep = depth + 1 + MedianLevels(count - 1) > MAX_DEPTH;
+
+        int leftCount;
+        if (split && !deep) {
+            float scale = BINS / extent[bestAxis];
+            float origin = centroidBounds.min[bestAxis];
+            int* middle = partition(
+                &order[start], &order[start] + count,
+                [&](int i) {
+                    int b = std::min(BINS - 1, (int) ((centroids[i][bestAxis] - origin) * scale));
+                    return b <= bestSplit;
+                }
+            );
+            leftCount = middle - &order[start];
+        } else if (count > MAX_LEAF_COUNT || (split && depth < MAX_DEPTH)) {
+            int axis = extent.x > extent.y ? 0 : 1;
+            if (extent.z > extent[axis]) {
+                axis = 2;
+            }
+            leftCount = count / 2;
+            nth_element(
+                &order[start], &order[start] + leftCount, &order[start] + count,
+                [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; }
+            );
+        } else {
+            return;
+        }
+
+        int child = tree.size();
+        BVHNode node;
+        node.start = start;
+        node.count = leftCount;
+        tree.push_back(node);
+        node.start = start + leftCount;
+        node.count = count - leftCount;
+        tree.push_back(node);
+
+        tree[index].start = child;
+        tree[index].count = 0;
+
+        Subdivide(tree, child, depth + 1, lo, hi, centroids, order);
+        Subdivide(tree, child + 1, depth + 1, lo, hi, centroids, order);
+    }
+
+#ifdef BVH_COMPRESSED
+    /* Collapses the binary tree into wide nodes */
+    void Compress(const vector<BVHNode>& tree) {
+        nodes.reserve(tree.size() / 2 + 1);
+        nodes.resize(1);
+
+        int children[4];
+        int numChildren = Gather(tree, 0, children);
+        BVHWideNode root = MakeWide(tree, children, numChildren);
+        nodes[0] = root;
+    }
+
+    /* Children of a wide node standing for tree[index]: its two children,
+    with the largest inner one replaced by its own children until there are
+    four. A leaf root becomes the single child of the wide root. */
+    static int Gather(const vector<BVHNode>& tree, int index, int (&children)[4]) {
+        if (tree[index].IsLeaf()) {
+            children[0] = index;
+            return 1;
+        }
+
+        children[0] = tree[index].start;
+        children[1] = tree[index].start + 1;
+        int n = 2;
+        while (n < 4) {
+            int largest = -1;
+            float largestArea = -1;
+            for (int i = 0; i < n; i++) {
+                const BVHNode& c = tree[children[i]];
+                float area = Area(c.min, c.max);
+                if (!c.IsLeaf() && area > largestArea) {
+                    largest = i;
+                    largestArea = area;
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            int inner = children[largest];
+            children[largest] = tree[inner].start;
+            children[n++] = tree[inner].start + 1;
+        }
+        return n;
+    }
+
+    BVHWideNode MakeWide(const vector<BVHNode>& tree, const int (&children)[4], int n) {
+        BVHWideNode node;
+
+        Bin bounds;
+        for (int i = 0; i < n; i++) {
+            bounds.Grow(tree[children[i]].min, tree[children[i]].max);
+        }
+
+        // Slightly more than 1/255 of the box per step so that rounding can
+        // not leave the top of the box outside the grid
+        node.origin = bounds.min;
+        node.scale = (bounds.max - bounds.min) * (1.0001f / 255.f);
+
+        for (int c = 0; c < 4; c++) {
+            if (c >= n) {
+                node.child[c] = BVHWideNode::EMPTY;
+                for (int axis = 0; axis < 3; axis++) {
+                    node.lo[axis][c] = node.hi[axis][c] = 0;
+                }
+                continue;
+            }
+
+            const BVHNode& child = tree[children[c]];
+            for (int axis = 0; axis < 3; axis++) {
+                Quantise(node, axis, c, child.min[axis], child.max[axis]);
+            }
+
+            if (child.IsLeaf()) {
+                node.child[c] = BVHWideNode::LEAF | child.start << 4 | (child.count - 1);
+            } else {
+                // Reserve the slot before recursing, which may grow `nodes`
+                int index = nodes.size();
+                nodes.resize(index + 1);
+                int grandChildren[4];
+                int numGrandChildren = Gather(tree, children[c], grandChildren);
+                BVHWideNode wide = MakeWide(tree, grandChildren, numGrandChildren);
+                nodes[index] = wide;
+                node.child[c] = index;
+            }
+        }
+        return node;
+    }
+
+    /* Refits the subtree below nodes[index] and sets [min, max] to its box.
+    The children's boxes are requantised on the node's new grid. */
+    void RefitWide(
+        int index, const vector<vec3>& lo, const vector<vec3>& hi, vec3& min, vec3& max
+    ) {
+        BVHWideNode& node = nodes[index];
+        Bin children[4], bounds;
+        for (int c = 0; c < 4; c++) {
+            uint32_t ref = node.child[c];
+            if (ref == BVHWideNode::EMPTY) {
+                continue;
+            }
+            if (ref & BVHWideNode::LEAF) {
+                int start = (ref & ~BVHWideNode::LEAF) >> 4;
+                int count = (ref & 15) + 1;
+                for (int i = start; i < start + count; i++) {
+                    children[c].Grow(lo[i], hi[i]);
+                }
+            } else {
+                RefitWide(ref, lo, hi, children[c].min, children[c].max);
+            }
+            bounds.Grow(children[c].min, children[c].max);
+        }
+
+        node.origin = bounds.min;
+        node.scale = (bounds.max - bounds.min) * (1.0001f / 255.f);
+        for (int c = 0; c < 4; c++) {
+            if (node.child[c] == BVHWideNode::EMPTY) {
+                continue;
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                Quantise(node, axis, c, children[c].min[axis], children[c].max[axis]);
+            }
+        }
+        min = bounds.min;
+        max = bounds.max;
+    }
+
+    /* Rounds [min, max] outwards onto the node's grid on one axis */
+    static void Quantise(BVHWideNode& node, int axis, int c, float min, float max) {
+        float origin = node.origin[axis], scale = node.scale[axis];
+        if (scale <= 0) {
+            node.lo[axis][c] = node.hi[axis][c] = 0;
+            return;
+        }
+
+        int lo = std::max(0, std::min(255, (int) floor((min - origin) / scale)));
+        int hi = std::max(0, std::min(255, (int) ceil((max - origin) / scale)));
+        while (lo > 0 && origin + lo * scale > min) {
+            lo--;
+        }
+        while (hi < 255 && origin + hi * scale < max) {
+            hi++;
+        }
+        node.lo[axis][c] = lo;
+        node.hi[axis][c] = hi;
+    }
+#endif
+};
+
+#endif
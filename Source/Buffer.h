@@ -0,0 +1,116 @@
+#ifndef __H_BUFFER_H__
+#define __H_BUFFER_H__
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+/* Array with the subset of the std::vector interface the geometry code uses.
+It either owns its elements or views read-only elements that live somewhere
+else, such as a memory-mapped scene cache, without copying them. Anything
+that may write to a viewed buffer, including the non-const accessors, first
+copies the elements into owned storage; so the render threads only read
+buffers through const references. */
+template <typename T>
+class Buffer {
+public:
+    Buffer() : mapped(NULL), mappedSize(0) {}
+
+    Buffer(const Buffer& other) : owned(other.begin(), other.end()),
+        mapped(NULL), mappedSize(0) {}
+
+    Buffer& operator=(const Buffer& other) {
+        if (this != &other) {
+            vector<T> copy(other.begin(), other.end());
+            owned.swap(copy);
+            mapped = NULL;
+            mappedSize = 0;
+        }
+        return *this;
+    }
+
+    /* Views n elements at data. The memory must outlive the buffer or the
+    next call that resizes it. */
+    void Map(const T* data, size_t n) {
+        vector<T>().swap(owned);
+        mapped = data;
+        mappedSize = n;
+    }
+
+    bool IsMapped() const {
+        return mapped != NULL;
+    }
+
+    size_t size() const {
+        return mapped ? mappedSize : owned.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    T* data() {
+        Detach();
+        return owned.data();
+    }
+
+    const T* data() const {
+        return mapped ? mapped : owned.data();
+    }
+
+    T& operator[](size_t i) {
+        Detach();
+        return owned[i];
+    }
+
+    const T& operator[](size_t i) const {
+        return data()[i];
+    }
+
+    T* begin() { return data(); }
+    T* end() { return data() + size(); }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+
+    T& back() {
+        Detach();
+        return owned.back();
+    }
+
+    void push_back(const T& value) {
+        Detach();
+        owned.push_back(value);
+    }
+
+    void resize(size_t n) {
+        Detach();
+        owned.resize(n);
+    }
+
+    void reserve(size_t n) {
+        Detach();
+        owned.reserve(n);
+    }
+
+    void clear() {
+        mapped = NULL;
+        mappedSize = 0;
+        owned.clear();
+    }
+
+private:
+    vector<T> owned;
+    const T* mapped;
+    size_t mappedSize;
+
+    void Detach() {
+        if (mapped) {
+            owned.assign(mapped, mapped + mappedSize);
+            mapped = NULL;
+            mappedSize = 0;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef __H_CHECKPOINT_H__
+#define __H_CHECKPOINT_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AccumulationBuffer.h"
+
+using namespace std;
+
+/* Saved progress of a render, so that a killed run can be resumed where its
+last checkpoint left off. Besides the accumulated samples, a checkpoint holds
+the strata each tile has used and the state of the random generators; a
+resumed run draws new samples rather than repeating the ones already in the
+image, so the result is the same as if it had never stopped.
+
+Writing happens on a background thread from a copy of the state, so the
+render only waits for the copy. */
+class Checkpoint {
+public:
+    static const uint32_t VERSION = 2;
+
+    struct State {
+        int width, height;
+        int tiles, samples;         // strata are tiles x samples x samples flags
+        uint32_t scene;             // fingerprint of the scene, set by the caller
+        int frame;                  // frame of the animation script, if any
+        int passes;                 // passes in the frame's image so far
+        vector<AccumulationBuffer::Texel> texels;
+        vector<uint8_t> strata;
+        vector<string> generators;  // as written by the generators' operator<<
+    };
+
+    Checkpoint() : busy(false) {}
+
+    ~Checkpoint() {
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+
+    /* Starts writing `state` to `filename` in the background and takes the
+    state's buffers. Returns false without writing if the previous checkpoint
+    is still being written. */
+    bool Save(const char* filename, State& state) {
+        if (busy.load(memory_order_acquire)) {
+            return false;
+        }
+        if (writer.joinable()) {
+            writer.join();
+        }
+
+        busy.store(true, memory_order_relaxed);
+        pending = move(state);
+        writer = thread([this](string filename) {
+            if (!Write(filename.c_str(), pending)) {
+                cout << "Could not write " << filename << endl;
+            }
+            busy.store(false, memory_order_release);
+        }, string(filename));
+        return true;
+    }
+
+    /* Reads a checkpoint into `state`, whose width, height, tiles, samples
+    and scene have to be set to the current render's; a checkpoint of a
+    different render is rejected. */
+    static bool Load(const char* filename, State& state) {
+        FILE* f = fopen(filename, "rb");
+        if (f == NULL) {
+            return false;
+        }
+
+        Header header;
+        bool ok = fread(&header, sizeof(Header), 1, f) == 1 &&
+            memcmp(header.magic, "RTCHKPT", 8) == 0 && header.version == VERSION &&
+            header.width == state.width && header.height == state.height &&
+            header.tiles == state.tiles && header.samples == state.samples &&
+            header.scene == state.scene;
+
+        if (ok) {
+            state.frame = header.frame;
+            state.passes = header.passes;
+            state.texels.resize((size_t) state.width * state.height);
+            state.strata.resize((size_t) state.tiles * state.samples * state.samples);
+            ok = Read(f, state.texels.data(), state.texels.size() * sizeof(AccumulationBuffer::Texel)) &&
+                 Read(f, state.strata.data(), state.strata.size());
+        }
+
+        state.generators.clear();
+        for (uint32_t i = 0; ok && i < header.numGenerators; i++) {
+            uint32_t length;
+            ok = Read(f, &length, sizeof(length)) && length < 1 << 16;
+            if (ok) {
+                string generator(length, ' ');
+                ok = Read(f, &generator[0], length);
+                state.generators.push_back(generator);
+            }
+        }
+
+        fclose(f);
+        return ok;
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        int32_t width, height;
+        int32_t tiles, samples;
+        uint32_t scene;
+        int32_t frame, passes;
+        uint32_t numGenerators;
+    };
+
+    thread writer;
+    atomic<bool> busy;
+
+    // The state being written, owned by the writer while busy
+    State pending;
+
+    /* Writes under a temporary name and renames, so a run killed while
+    writing leaves the previous checkpoint intact */
+    static bool Write(const char* filename, const State& state) {
+        Header header;
+        memset(&header, 0, sizeof(Header));
+        memcpy(header.magic, "RTCHKPT", 8);
+        header.version = VERSION;
+        header.width = state.width;
+        header.height = state.height;
+        header.tiles = state.tiles;
+        header.samples = state.samples;
+        header.scene = state.scene;
+        header.frame = state.frame;
+        header.passes = state.passes;
+        header.numGenerators = state.generators.size();
+
+        string temporary = string(filename) + ".tmp";
+        FILE* f = fopen(temporary.c_str(), "wb");
+        if (f == NULL) {
+            return false;
+        }
+
+        bool ok = fwrite(&header, sizeof(Header), 1, f) == 1 &&
+            Write(f, state.texels.data(), state.texels.size() * sizeof(AccumulationBuffer::Texel)) &&
+            Write(f, state.strata.data(), state.strata.size());
+        for (size_t i = 0; ok && i < state.generators.size(); i++) {
+            uint32_t length = state.generators[i].size();
+            ok = Write(f, &length, sizeof(length)) &&
+                 Write(f, state.generators[i].data(), length);
+        }
+
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), filename) != 0) {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static bool Write(FILE* f, const void* data, size_t bytes) {
+        return bytes == 0 || fwrite(data, 1, bytes, f) == bytes;
+    }
+
+    static bool Read(FILE* f, void* data, size_t bytes) {
+        return bytes == 0 || fread(data, 1, bytes, f) == bytes;
+    }
+};
+
+#endif
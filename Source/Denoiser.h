@@ -0,0 +1,200 @@
+#ifndef __H_DENOISER_H__
+#define __H_DENOISER_H__
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AOV.h"
+
+using namespace std;
+using namespace glm;
+
+/* Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010). Each
+iteration blurs the image with a 5x5 B3-spline kernel whose taps are spread
+twice as far apart as in the previous one, so five iterations cover 61x61
+pixels at the cost of 25 taps each. A tap's weight falls off with how much
+the neighbour differs from the pixel in colour and in the guides, the
+averaged albedo, normal and depth of the AOV buffer. Edges
+between objects, materials and surface orientations are kept while the
+noise inside them is smoothed out.
+
+All data is stored as one plane per channel, and the filter runs over a row
+one tap at a time without branches or calls, so that the compiler turns the
+inner loop into SIMD code. Rows are split over threads. */
+class Denoiser {
+public:
+    static const int ITERATIONS = 5;
+
+    // How much of a difference halves a tap's weight, roughly. The colour
+    // tolerance is halved every iteration, as the image gets smoother.
+    float sigmaColor, sigmaAlbedo, sigmaNormal, sigmaDepth;
+
+    int width, height;
+
+    // Colour to filter, one plane per channel, row by row. Filter() leaves
+    // the result here.
+    vector<float> color[3];
+
+    Denoiser(int width, int height)
+    : sigmaColor(0.6f), sigmaAlbedo(0.1f), sigmaNormal(0.3f), sigmaDepth(0.05f),
+      width(width), height(height) {
+        int n = width * height;
+        for (int c = 0; c < 3; c++) {
+            color[c].resize(n);
+            scratch[c].resize(n);
+        }
+        guide.resize(GUIDES);
+        for (int g = 0; g < GUIDES; g++) {
+            guide[g].resize(n);
+            guides[g] = guide[g].data();
+        }
+    }
+
+    /* Filters `color` in place using numThreads threads, guided by `aov`
+    of the same size */
+    void Filter(int numThreads, const AOVBuffer& aov) {
+        numThreads = std::max(1, std::min(numThreads, height));
+        Run(numThreads, [this, &aov](int y1, int y2) { PrepareGuides(aov, y1, y2); });
+        for (int i = 0; i < ITERATIONS; i++) {
+            Run(numThreads, [this, i](int y1, int y2) { Iterate(i, y1, y2); });
+            for (int c = 0; c < 3; c++) {
+                color[c].swap(scratch[c]);
+            }
+        }
+    }
+
+private:
+    // The guides as compared by the filter: averaged albedo and normal
+    // scaled by their tolerance, and depth as a fraction of its own value
+    enum { ALBEDO_R, ALBEDO_G, ALBEDO_B, NORMAL_X, NORMAL_Y, NORMAL_Z, DEPTH, INVERSE_DEPTH, GUIDES };
+
+    vector<vector<float> > guide;
+    const float* guides[GUIDES];
+    vector<float> scratch[3];
+
+    /* Calls work(y1, y2) for bands of rows on numThreads threads */
+    template <typename Work>
+    void Run(int numThreads, Work work) {
+        vector<thread> threads;
+        for (int t = 1; t < numThreads; t++) {
+            threads.push_back(thread(work, t * height / numThreads, (t + 1) * height / numThreads));
+        }
+        work(0, height / numThreads);
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+
+    void PrepareGuides(const AOVBuffer& aov, int y1, int y2) {
+        for (int i = y1 * width; i < y2 * width; i++) {
+            vec3 albedo = aov.Albedo(i), normal = aov.Normal(i);
+            for (int c = 0; c < 3; c++) {
+                guide[ALBEDO_R + c][i] = albedo[c] / sigmaAlbedo;
+                guide[NORMAL_X + c][i] = normal[c] / sigmaNormal;
+            }
+            float z = aov.Depth(i);
+            guide[DEPTH][i] = z;
+            guide[INVERSE_DEPTH][i] = 1.f / (z * z * sigmaDepth * sigmaDepth + 1e-6f);
+        }
+    }
+
+    /* 1 / (1 + d + d^2/2 + d^3/6): close to exp(-d) for small differences,
+    never zero, and no call that would keep the loop from vectorising */
+    static float Falloff(float d) {
+        return 1.f / (1.f + d * (1.f + d * (0.5f + d * (1.f / 6.f))));
+    }
+
+    /* Adds one tap, with kernel weight h, to the sums of pixels x1 to x2 - 1
+    of a row: pixel i0 + x is filtered with neighbour j0 + x. A function of
+    its own because GCC only trusts restrict on parameters; knowing that the
+    sums do not overlap the planes, it keeps the plane pointers in registers
+    and vectorises the loop. */
+    static void Tap(
+        const float* const planes[3 + GUIDES],
+        float* __restrict__ sumR, float* __restrict__ sumG,
+        float* __restrict__ sumB, float* __restrict__ sumW,
+        int x1, int x2, int i0, int j0, float h, float colorScale
+    ) {
+        const float* r = planes[0];
+        const float* g = planes[1];
+        const float* b = planes[2];
+        const float* albedoR = planes[3 + ALBEDO_R];
+        const float* albedoG = planes[3 + ALBEDO_G];
+        const float* albedoB = planes[3 + ALBEDO_B];
+        const float* normalX = planes[3 + NORMAL_X];
+        const float* normalY = planes[3 + NORMAL_Y];
+        const float* normalZ = planes[3 + NORMAL_Z];
+        const float* depth = planes[3 + DEPTH];
+        const float* inverseDepth = planes[3 + INVERSE_DEPTH];
+
+        for (int x = x1; x < x2; x++) {
+            int i = i0 + x, j = j0 + x;
+            float dr = r[i] - r[j], dg = g[i] - g[j], db = b[i] - b[j];
+            float ar = albedoR[i] - albedoR[j], ag = albedoG[i] - albedoG[j],
+                  ab = albedoB[i] - albedoB[j];
+            float nx = normalX[i] - normalX[j], ny = normalY[i] - normalY[j],
+                  nz = normalZ[i] - normalZ[j];
+            float dz = depth[i] - depth[j];
+            float d = (dr * dr + dg * dg + db * db) * colorScale +
+                      ar * ar + ag * ag + ab * ab + nx * nx + ny * ny + nz * nz +
+                      dz * dz * inverseDepth[i];
+
+            float w = h * Falloff(d);
+            sumR[x] += w * r[j];
+            sumG[x] += w * g[j];
+            sumB[x] += w * b[j];
+            sumW[x] += w;
+        }
+    }
+
+    void Iterate(int iteration, int y1, int y2) {
+        static const float KERNEL[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+        int step = 1 << iteration;
+        float sigma = sigmaColor / (1 << iteration);
+        float colorScale = 1.f / (sigma * sigma);
+
+        vector<float> sum[3], weights(width);
+        for (int c = 0; c < 3; c++) {
+            sum[c].resize(width);
+        }
+
+        // The colour planes, then the guides
+        const float* planes[3 + GUIDES] = { color[0].data(), color[1].data(), color[2].data() };
+        for (int k = 0; k < GUIDES; k++) {
+            planes[3 + k] = guides[k];
+        }
+
+        for (int y = y1; y < y2; y++) {
+            fill(weights.begin(), weights.end(), 0.f);
+            for (int c = 0; c < 3; c++) {
+                fill(sum[c].begin(), sum[c].end(), 0.f);
+            }
+
+            for (int ky = 0; ky < 5; ky++) {
+                int sy = y + (ky - 2) * step;
+                if (sy < 0 || sy >= height) {
+                    continue;
+                }
+                for (int kx = 0; kx < 5; kx++) {
+                    int dx = (kx - 2) * step;
+                    Tap(
+                        planes, sum[0].data(), sum[1].data(), sum[2].data(), weights.data(),
+                        std::max(0, -dx), std::min(width, width - dx),
+                        y * width, sy * width + dx, KERNEL[ky] * KERNEL[kx], colorScale
+                    );
+                }
+            }
+
+            // The centre tap always counts, so the weights are never zero
+            for (int x = 0; x < width; x++) {
+                float inverse = 1.f / weights[x];
+                scratch[0][y * width + x] = sum[0][x] * inverse;
+                scratch[1][y * width + x] = sum[1][x] * inverse;
+                scratch[2][y * width + x] = sum[2][x] * inverse;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef __H_DISTRIBUTED_H__
+#define __H_DISTRIBUTED_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "AccumulationBuffer.h"
+
+using namespace std;
+using namespace glm;
+
+/* Rendering with worker processes, on this machine or others, over TCP.
+
+The coordinator owns the image. It hands out jobs of one pass over one
+tile, with the stratum to sample, and adds the returned pass to its
+accumulation buffer just as a local worker would. A tile's passes can be
+rendered by different workers at the same time. A worker that disconnects
+or stops answering has its job handed to another, with the same stratum,
+so every tile still gets each stratum exactly once.
+
+Workers run the same binary with the same scene arguments. They introduce
+themselves with the image and scene they were set up for, and are turned
+away if it does not match the coordinator's. Both sides have to have the
+same byte order and float layout, which is not checked. */
+
+/* First message from a worker */
+struct TileHello {
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;
+    int32_t tiles, samples;
+    uint32_t scene;             // fingerprint of the scene, set by the caller
+
+    static const uint32_t VERSION = 1;
+
+    TileHello() {
+        memset(this, 0, sizeof(TileHello));
+        memcpy(magic, "RTWORKER", 8);
+        version = VERSION;
+    }
+};
+
+/* FNV-1a over the bytes of the scene, for TileHello::scene. Only give it
+data without padding, so that every byte hashed is set. */
+struct SceneHash {
+    uint32_t value;
+
+    SceneHash() : value(2166136261u) {}
+
+    void Add(const void* data, size_t bytes) {
+        const uint8_t* p = (const uint8_t*) data;
+        for (size_t i = 0; i < bytes; i++) {
+            value = (value ^ p[i]) * 16777619u;
+        }
+    }
+
+    template <typename T>
+    void Add(const T& v) {
+        Add(&v, sizeof(T));
+    }
+};
+
+/* One pass over one tile. `seed` is unique per job, so that workers in
+different processes do not draw the same random numbers. */
+struct TileJob {
+    int32_t tile;
+    int32_t stratum;
+    uint32_t seed;
+};
+
+/* Sent back before the tile's pixels, as vec3s row by row */
+struct TileResult {
+    int32_t tile;
+    int32_t stratum;
+};
+
+/* Blocking socket helpers. send() must not raise SIGPIPE when the other side
+is gone; that is an ordinary failure here. */
+inline bool SendAll(int fd, const void* data, size_t bytes) {
+    const char* p = (const char*) data;
+    while (bytes > 0) {
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+inline bool ReceiveAll(int fd, void* data, size_t bytes) {
+    char* p = (char*) data;
+    while (bytes > 0) {
+        ssize_t n = recv(fd, p, bytes, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+class TileCoordinator {
+public:
+    /* Gives up on a worker that takes longer than this for one job */
+    static const int JOB_TIMEOUT = 60;      // seconds
+
+    /* Renders `passes` passes of every tile of `accumulation`, for workers
+    that introduce themselves with `hello` */
+    TileCoordinator(AccumulationBuffer& accumulation, int passes, const TileHello& hello)
+    : accumulation(accumulation), hello(hello), passes(passes), listener(-1),
+      stopping(false), nextSeed(1), workers(0) {
+        int tiles = accumulation.NumTiles();
+        issued.assign(tiles, 0);
+        committed.assign(tiles, 0);
+
+        // Strata in random order for each tile, taken from the front
+        default_random_engine shuffler;
+        strata.resize(tiles);
+        for (int i = 0; i < tiles; i++) {
+            for (int s = 0; s < hello.samples * hello.samples; s++) {
+                strata[i].push_back(s);
+            }
+            shuffle(strata[i].begin(), strata[i].end(), shuffler);
+        }
+    }
+
+    ~TileCoordinator() {
+        Stop();
+    }
+
+    /* Starts accepting workers on `port` */
+    bool Listen(int port) {
+        listener = socket(AF_INET6, SOCK_STREAM, 0);
+        if (listener < 0) {
+            return false;
+        }
+        int yes = 1, no = 0;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+
+        sockaddr_in6 address;
+        memset(&address, 0, sizeof(address));
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        if (::bind(listener, (sockaddr*) &address, sizeof(address)) != 0 ||
+            listen(listener, 64) != 0) {
+            close(listener);
+            listener = -1;
+            return false;
+        }
+
+        acceptor = thread(&TileCoordinator::Accept, this);
+        return true;
+    }
+
+    /* Disconnects all workers and waits for the connection threads */
+    void Stop() {
+        {
+            lock_guard<mutex> lock(jobsMutex);
+            if (stopping) {
+                return;
+            }
+            stopping = true;
+            for (size_t i = 0; i < sockets.size(); i++) {
+                shutdown(sockets[i], SHUT_RDWR);
+            }
+        }
+        jobsChanged.notify_all();
+
+        if (listener >= 0) {
+            shutdown(listener, SHUT_RDWR);
+            close(listener);
+        }
+        if (acceptor.joinable()) {
+            acceptor.join();
+        }
+        for (size_t i = 0; i < connections.size(); i++) {
+            connections[i].join();
+        }
+    }
+
+    /* Passes completed by every tile */
+    int PassesDone() {
+        lock_guard<mutex> lock(jobsMutex);
+        return *min_element(committed.begin(), committed.end());
+    }
+
+private:
+    AccumulationBuffer& accumulation;
+    TileHello hello;
+    int passes;
+
+    int listener;
+    thread acceptor;
+    vector<thread> connections;     // only touched by the acceptor until Stop()
+
+    // Work still to hand out, guarded by jobsMutex: jobs of workers that
+    // failed, then the next stratum of the tile with the fewest passes
+    // handed out
+    mutex jobsMutex;
+    condition_variable jobsChanged;
+    deque<TileJob> returned;
+    vector<vector<int> > strata;
+    vector<int> issued;
+    vector<int> committed;
+    vector<int> sockets;
+    bool stopping;
+    uint32_t nextSeed;
+
+    // Commit() expects one writer per tile; passes of a tile can come back
+    // from several workers at once
+    mutex commitMutex;
+
+    atomic<int> workers;
+
+    void Accept() {
+        for (;;) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                return;
+            }
+
+            lock_guard<mutex> lock(jobsMutex);
+            if (stopping) {
+                close(fd);
+                return;
+            }
+            sockets.push_back(fd);
+            connections.push_back(thread(&TileCoordinator::Serve, this, fd));
+        }
+    }
+
+    /* Hands jobs to one worker until it fails or the render is done */
+    void Serve(int fd) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        timeval timeout = { JOB_TIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        TileHello theirs;
+        if (!ReceiveAll(fd, &theirs, sizeof(TileHello)) ||
+            memcmp(&theirs, &hello, sizeof(TileHello)) != 0) {
+            cout << "Turned away a worker rendering a different image or scene." << endl;
+            Close(fd);
+            return;
+        }
+        cout << "Worker connected (" << ++workers << " in total)." << endl;
+
+        vector<vec3> pass;
+        TileJob job;
+        while (Take(job)) {
+            int x1, y1, x2, y2;
+            accumulation.TileBounds(job.tile, x1, y1, x2, y2);
+            pass.resize((x2 - x1) * (y2 - y1));
+
+            TileResult result;
+            if (!SendAll(fd, &job, sizeof(TileJob)) ||
+                !ReceiveAll(fd, &result, sizeof(TileResult)) ||
+                result.tile != job.tile || result.stratum != job.stratum ||
+                !ReceiveAll(fd, pass.data(), pass.size() * sizeof(vec3))) {
+                Return(job);
+                break;
+            }
+
+            {
+                lock_guard<mutex> lock(commitMutex);
+                accumulation.Commit(job.tile, pass);
+            }
+            Complete(job);
+        }
+
+        cout << "Worker disconnected (" << --workers << " left)." << endl;
+        Close(fd);
+    }
+
+    void Close(int fd) {
+        {
+            lock_guard<mutex> lock(jobsMutex);
+            sockets.erase(find(sockets.begin(), sockets.end(), fd));
+        }
+        close(fd);
+    }
+
+    /* Waits for a job; false once there is nothing left to do */
+    bool Take(TileJob& job) {
+        unique_lock<mutex> lock(jobsMutex);
+        for (;;) {
+            if (stopping) {
+                return false;
+            }
+            if (!returned.empty()) {
+                job = returned.front();
+                returned.pop_front();
+                return true;
+            }
+
+            int tile = min_element(issued.begin(), issued.end()) - issued.begin();
+            if (issued[tile] < passes) {
+                job.tile = tile;
+                job.stratum = strata[tile][issued[tile]++];
+                job.seed = nextSeed++;
+                return true;
+            }
+
+            // Everything is handed out; wait in case a job comes back
+            if (*min_element(committed.begin(), committed.end()) == passes) {
+                return false;
+            }
+            jobsChanged.wait(lock);
+        }
+    }
+
+    void Return(const TileJob& job) {
+        {
+            lock_guard<mutex> lock(jobsMutex);
+            returned.push_back(job);
+        }
+        jobsChanged.notify_one();
+    }
+
+    void Complete(const TileJob& job) {
+        {
+            lock_guard<mutex> lock(jobsMutex);
+            committed[job.tile]++;
+        }
+        jobsChanged.notify_all();
+    }
+};
+
+class TileWorker {
+public:
+    /* Renders one pass of a tile with the given stratum into `pass` */
+    typedef function<void(const TileJob& job, vector<vec3>& pass)> Render;
+
+    /* Connects to the coordinator at host:port and renders the jobs it
+    hands out until it disconnects. `pixels(tile)` is the number of pixels
+    of a tile. Returns false if the coordinator could not be reached, sent
+    a job for a tile or stratum that `hello` does not have, or went away
+    while a result was being sent. */
+    static bool Run(
+        const string& address, const TileHello& hello,
+        function<int(int)> pixels, Render render
+    ) {
+        size_t colon = address.rfind(':');
+        if (colon == string::npos) {
+            cout << "Expected host:port, got " << address << endl;
+            return false;
+        }
+        string host = address.substr(0, colon);
+        string port = address.substr(colon + 1);
+
+        addrinfo hints, *found;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+            cout << "Could not resolve " << host << endl;
+            return false;
+        }
+
+        int fd = -1;
+        for (addrinfo* a = found; a != NULL && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+        if (fd < 0) {
+            cout << "Could not connect to " << address << endl;
+            return false;
+        }
+
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        vector<vec3> pass;
+        TileJob job;
+        bool ok = SendAll(fd, &hello, sizeof(TileHello));
+        while (ok && ReceiveAll(fd, &job, sizeof(TileJob))) {
+            if (job.tile < 0 || job.tile >= hello.tiles ||
+                job.stratum < 0 || job.stratum >= hello.samples * hello.samples) {
+                cout << "Got a job for tile " << job.tile << ", stratum " << job.stratum
+                     << ", which do not exist." << endl;
+                ok = false;
+                break;
+            }
+            pass.resize(pixels(job.tile));
+            render(job, pass);
+
+            TileResult result;
+            result.tile = job.tile;
+            result.stratum = job.stratum;
+            ok = SendAll(fd, &result, sizeof(TileResult)) &&
+                 SendAll(fd, pass.data(), pass.size() * sizeof(vec3));
+        }
+
+        close(fd);
+        return ok;
+    }
+};
+
+#endif
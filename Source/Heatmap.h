@@ -0,0 +1,75 @@
+#ifndef __H_HEATMAP_H__
+#define __H_HEATMAP_H__
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <time.h>
+#include "SDLauxiliary.h"
+
+using namespace std;
+using namespace glm;
+
+class Heatmap {
+public:
+    /* CPU time of the calling thread in microseconds. Wall time would also
+    count the time a worker spends preempted, which says nothing about how
+    expensive the pixel is. */
+    static double ThreadTime() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+    }
+
+    /* Maps t in [0, 1] onto a blue - cyan - green - yellow - red ramp */
+    static vec3 FalseColour(float t) {
+        t = clamp(t, 0.f, 1.f) * 4.f;
+        if (t < 1.f) {
+            return vec3(0, t, 1);
+        } else if (t < 2.f) {
+            return vec3(0, 1, 2.f - t);
+        } else if (t < 3.f) {
+            return vec3(t - 2.f, 1, 0);
+        } else {
+            return vec3(1, 4.f - t, 0);
+        }
+    }
+
+    /* Writes the per-pixel cost as a false-coloured bitmap. Costs are scaled
+    against the 99th percentile so a few pathological pixels do not wash out
+    the rest of the image. */
+    static void Save(
+        const char* filename,
+        const float (&cost)[SCREEN_HEIGHT][SCREEN_WIDTH],
+        const char* unit
+    ) {
+        vector<float> sorted(&cost[0][0], &cost[0][0] + SCREEN_HEIGHT * SCREEN_WIDTH);
+        size_t p99 = sorted.size() * 99 / 100;
+        nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+        float scale = sorted[p99] > 0 ? 1.f / sorted[p99] : 0.f;
+
+        float total = 0, highest = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            total += sorted[i];
+            highest = std::max(highest, sorted[i]);
+        }
+
+        SDL_Surface* image = SDL_CreateRGBSurface(
+            SDL_SWSURFACE, SCREEN_WIDTH, SCREEN_HEIGHT, 32,
+            0x00FF0000, 0x0000FF00, 0x000000FF, 0
+        );
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                PutPixelSDL(image, x, y, FalseColour(cost[y][x] * scale));
+            }
+        }
+        SDL_SaveBMP(image, filename);
+        SDL_FreeSurface(image);
+
+        cout << "Saved " << filename << ": mean " << total / sorted.size()
+             << ", p99 " << sorted[p99] << ", max " << highest << " " << unit
+             << " per pixel." << endl;
+    }
+};
+
+#endif
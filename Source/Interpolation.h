@@ -12,10 +12,9 @@ public:
             return;
         }
 
-        bool interpUV = (
-            verts[0].triangle->material.texture ||
-            verts[0].triangle->material.normalMap
-        );
+        // The result lies on the first vertex's triangle
+        const Material& material = MaterialTable::Get(verts[0].triangle->materialId);
+        bool interpUV = material.texture || material.normalMap;
 
         // Initialise values for interpolation
         result.invZ = 0;
@@ -45,13 +44,10 @@ public:
         }
 
         // Calculate normal if normal map in use
-        if (
-            result.triangle->material.normalMap &&
-            result.triangle->material.normalMapImage != NULL
-        ) {
-            int x = (int)(result.triangle->material.normalMapImage->w * result.u);
-            int y = (int)(result.triangle->material.normalMapImage->h * result.v);
-            vec3 normMapValue = GetPixelSDL(result.triangle->material.normalMapImage, x, y);
+        if (material.normalMap && material.normalMapImage != NULL) {
+            int x = (int)(material.normalMapImage->w * result.u);
+            int y = (int)(material.normalMapImage->h * result.v);
+            vec3 normMapValue = GetPixelSDL(material.normalMapImage, x, y);
             normMapValue.x = normMapValue.x * 2 - 1;
             normMapValue.y = normMapValue.y * 2 - 1;
             normMapValue.z = normMapValue.z * 2 - 1;
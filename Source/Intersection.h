@@ -6,6 +6,10 @@
 #include <limits>
 #include "Primitive.h"
 #include "Sphere.h"
+#include "Mesh.h"
+#include "MeshInstance.h"
+#include "Pager.h"
+#include "Scene.h"
 #include "Ray.h"
 
 using namespace std;
@@ -20,47 +24,57 @@ public:
     Primitive* primitive;
     int primitiveIndex;
 
+    // Face of the mesh that was hit, -1 if the primitive is not a mesh
+    int faceIndex;
+
+    // Material at the intersection
+    MaterialId materialId;
+
     Intersection() {
         position = vec3(0,0,0);
         normal = vec3(0,0,0);
         distance = 0;
         primitive = NULL;
         primitiveIndex = -1;
+        faceIndex = -1;
+        materialId = 0;
+    }
+
+    const Material& GetMaterial() const {
+        return MaterialTable::Get(materialId);
+    }
+
+    Material::Shading GetShading() const {
+        return MaterialTable::GetShading(materialId);
     }
 
     // On successfully finding an intersection between the ray and any
     //of the triangle planes, true is returned and closestIntersection set.
+    // The primitive (and for meshes, the face) being ignored is usually the
+    // one the ray starts from.
     static bool ClosestIntersection(
         Ray ray,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         Intersection& intersection,
-        int ignoreIndex
+        int ignoreIndex,
+        int ignoreFace = -1
     ) {
         float closest = numeric_limits<float>::max();
+        const vector<Primitive*>& primitives = scene.primitives;
 
-        int size = primitives.size();
-        for (int i = 0; i < size; i++) {
-            if (i == ignoreIndex) {
-                continue;
-            }
-
-            if (primitives[i]->isTriangle) {
-                IntersectTriangle(
-                    ray,
-                    (Triangle*) primitives[i],
-                    intersection,
-                    closest,
-                    i
-                );
-            } else if (primitives[i]->isSphere) {
-                IntersectSphere(
-                    ray,
-                    (Sphere*) primitives[i],
-                    intersection,
-                    closest,
-                    i
+        if (scene.bvh.Empty()) {
+            int size = primitives.size();
+            for (int i = 0; i < size; i++) {
+                IntersectPrimitive(
+                    ray, primitives[i], intersection, closest, i, ignoreIndex, ignoreFace
                 );
             }
+        } else {
+            scene.bvh.Traverse(ray.s, ray.d, closest, [&](int i) {
+                IntersectPrimitive(
+                    ray, primitives[i], intersection, closest, i, ignoreIndex, ignoreFace
+                );
+            });
         }
 
         if (closest < numeric_limits<float>::max()) {
@@ -78,6 +92,62 @@ public:
         }
     }
 
+    static void IntersectPrimitive(
+        const Ray& ray,
+        Primitive* primitive,
+        Intersection& intersection,
+        float& closest,
+        int i,
+        int ignoreIndex,
+        int ignoreFace
+    ) {
+        if (primitive->isMesh) {
+            IntersectMesh(
+                ray,
+                (Mesh*) primitive,
+                intersection,
+                closest,
+                i,
+                i == ignoreIndex ? ignoreFace : -1
+            );
+            return;
+        }
+
+        if (primitive->isInstance) {
+            IntersectInstance(
+                ray,
+                (MeshInstance*) primitive,
+                intersection,
+                closest,
+                i,
+                i == ignoreIndex ? ignoreFace : -1
+            );
+            return;
+        }
+
+        if (i == ignoreIndex) {
+            return;
+        }
+
+        if (primitive->isTriangle) {
+            IntersectTriangle(
+                ray,
+                (Triangle*) primitive,
+                intersection,
+                closest,
+                i
+            );
+        } else if (primitive->isSphere) {
+            IntersectSphere(
+                ray,
+                (Sphere*) primitive,
+                intersection,
+                closest,
+                i
+            );
+        }
+    }
+
     static void IntersectTriangle(
         Ray ray,
         Triangle* triangle,
@@ -87,19 +157,172 @@ public:
     ) {
         // Backface culling
         if (
-            !triangle->material.isRefractive &&
+            !triangle->twoSided &&
             dot(ray.d, triangle->normal) > 0
         ) {
             return;
         }
 
-        vec3 e1 = triangle->v1 - triangle->v0;
-        vec3 e2 = triangle->v2 - triangle->v0;
-        vec3 b = ray.s - triangle->v0;
+        float t;
+        if (!RayTriangle(ray, triangle->v0, triangle->v1, triangle->v2, closest, t)) {
+            return;
+        }
+
+        intersection.position = ray.s + t * ray.d;
+        intersection.distance = glm::distance(ray.s, intersection.position);
+        intersection.normal = triangle->normal;
+        intersection.primitive = (Primitive*) triangle;
+        intersection.primitiveIndex = index;
+        intersection.faceIndex = -1;
+        intersection.materialId = triangle->materialId;
+        intersection.ray = ray;
+
+        closest = t;
+    }
+
+    static void IntersectMesh(
+        Ray ray,
+        const Mesh* mesh,
+        Intersection& intersection,
+        float& closest,
+        int index,
+        int ignoreFace
+    ) {
+        int hitFace = IntersectFaces(ray, mesh, closest, ignoreFace);
+        if (hitFace < 0) {
+            return;
+        }
+
+        intersection.position = ray.s + closest * ray.d;
+        intersection.distance = glm::distance(ray.s, intersection.position);
+        intersection.normal = mesh->normals[mesh->faces[hitFace].normal];
+        intersection.primitive = (Primitive*) mesh;
+        intersection.primitiveIndex = index;
+        intersection.faceIndex = hitFace;
+        intersection.materialId = mesh->faces[hitFace].material;
+        intersection.ray = ray;
+    }
+
+    /* Intersects the instance's mesh with the ray moved into object space.
+    Distances along the ray are the same in both spaces, so `closest` is
+    shared with the rest of the scene. */
+    static void IntersectInstance(
+        Ray ray,
+        MeshInstance* instance,
+        Intersection& intersection,
+        float& closest,
+        int index,
+        int ignoreFace
+    ) {
+        const Mesh* mesh = instance->mesh;
+        int hitFace = IntersectFaces(instance->ToObject(ray), mesh, closest, ignoreFace);
+        if (hitFace < 0) {
+            return;
+        }
+
+        intersection.position = ray.s + closest * ray.d;
+        intersection.distance = glm::distance(ray.s, intersection.position);
+        intersection.normal = instance->NormalToWorld(mesh->normals[mesh->faces[hitFace].normal]);
+        intersection.primitive = (Primitive*) instance;
+        intersection.primitiveIndex = index;
+        intersection.faceIndex = hitFace;
+        intersection.materialId = mesh->faces[hitFace].material;
+        intersection.ray = ray;
+    }
+
+    /* Closest face of the mesh hit by the ray, or -1 */
+    static int IntersectFaces(
+        const Ray& ray, const Mesh* mesh, float& closest, int ignoreFace
+    ) {
+        int hitFace = -1;
+
+        if (mesh->bvh.Empty()) {
+            int size = mesh->faces.size();
+            for (int i = 0; i < size; i++) {
+                if (IntersectFace(ray, mesh, i, ignoreFace, closest)) {
+                    hitFace = i;
+                }
+            }
+        } else if (mesh->pager == NULL) {
+            mesh->bvh.Traverse(ray.s, ray.d, closest, [&](int i) {
+                if (IntersectFace(ray, mesh, i, ignoreFace, closest)) {
+                    hitFace = i;
+                }
+            });
+        } else {
+            // Paged mesh: tell the pager about every node, face and vertex read
+            const Pager* pager = mesh->pager;
+            mesh->bvh.Traverse(ray.s, ray.d, closest, [&](int i) {
+                const MeshFace& f = mesh->faces[i];
+                pager->Touch(&f);
+                pager->Touch(&mesh->vertices[f.v[0]]);
+                pager->Touch(&mesh->vertices[f.v[1]]);
+                pager->Touch(&mesh->vertices[f.v[2]]);
+                pager->Touch(&mesh->normals[f.normal]);
+                if (IntersectFace(ray, mesh, i, ignoreFace, closest)) {
+                    hitFace = i;
+                }
+            }, [&](const void* node) {
+                pager->Touch(node);
+            });
+        }
+
+        return hitFace;
+    }
+
+    /* Tests one face of a mesh, with back-face culling. Returns true and
+    updates `closest` if the face is hit closer than before. */
+    static bool IntersectFace(
+        const Ray& ray, const Mesh* mesh, int i, int ignoreFace, float& closest
+    ) {
+        if (i == ignoreFace) {
+            return false;
+        }
+
+        const MeshFace& f = mesh->faces[i];
+
+        // Backface culling
+        if (
+            !(f.flags & MeshFace::TWO_SIDED) &&
+            dot(ray.d, mesh->normals[f.normal]) > 0
+        ) {
+            return false;
+        }
+
+        float t;
+        if (!RayTriangle(
+            ray,
+            mesh->vertices[f.v[0]],
+            mesh->vertices[f.v[1]],
+            mesh->vertices[f.v[2]],
+            closest,
+            t
+        )) {
+            return false;
+        }
+
+        closest = t;
+        return true;
+    }
+
+    /* Solves ray.s + t * ray.d = v0 + u * (v1 - v0) + v * (v2 - v0) with
+    Cramer's rule. Returns true and sets t if the triangle is hit in front of
+    the ray and closer than `closest`. */
+    static bool RayTriangle(
+        const Ray& ray,
+        const vec3& v0,
+        const vec3& v1,
+        const vec3& v2,
+        float closest,
+        float& t
+    ) {
+        vec3 e1 = v1 - v0;
+        vec3 e2 = v2 - v0;
+        vec3 b = ray.s - v0;
         mat3 A (-(ray.d), e1, e2);
         float dA = determinant(A);
         if (dA == 0) {
-            return;
+            return false;
         }
 
         vec3 x; // for (t, u, v)
@@ -108,7 +331,7 @@ public:
         x[0] = determinant(Ai) / dA;
 
         if (x[0] <= 0 || x[0] >= closest) {
-            return;
+            return false;
         }
 
         Ai[0] = A[0];
@@ -116,7 +339,7 @@ public:
         x[1] = determinant(Ai) / dA;
 
         if (x[1] < 0) {
-            return;
+            return false;
         }
 
         Ai[1] = A[1];
@@ -124,17 +347,11 @@ public:
         x[2] = determinant(Ai) / dA;
 
         if (x[2] < 0 || x[1] + x[2] > 1) {
-            return;
+            return false;
         }
 
-        intersection.position = ray.s + x[0] * ray.d;
-        intersection.distance = glm::distance(ray.s, intersection.position);
-        intersection.normal = triangle->normal;
-        intersection.primitive = (Primitive*) triangle;
-        intersection.primitiveIndex = index;
-        intersection.ray = ray;
-
-        closest = x[0];
+        t = x[0];
+        return true;
     }
 
     static void IntersectSphere(
@@ -183,6 +400,8 @@ public:
         intersection.normal = normalize(intersection.position - sphere->position);
         intersection.primitive = (Primitive*) sphere;
         intersection.primitiveIndex = index;
+        intersection.faceIndex = -1;
+        intersection.materialId = sphere->materialId;
         intersection.ray = ray;
 
         closest = t;
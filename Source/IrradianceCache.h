@@ -0,0 +1,174 @@
+#ifndef __H_IRRADIANCECACHE_H__
+#define __H_IRRADIANCECACHE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+/* Bounce light at diffuse surfaces, computed at sparse points and
+interpolated in between (Ward et al. 1988). Each record stores the light
+with its rotational and translational gradients (Ward and Heckbert 1992),
+and is valid within a radius that follows the distance to the surfaces
+around it; near walls and corners records are close together, in the open
+far apart.
+
+Records live in world space and are kept across passes and camera moves,
+until Clear(). They are stored in a hash grid of cells as wide as the
+largest radius a record can be used at, so a lookup reads 27 cells, each
+slot once even where cells share one. Workers
+insert without locks: a record is written to a slot of a preallocated pool
+first and then pushed onto its cell's list, which lookups on other threads
+read as they are. */
+class IrradianceCache {
+public:
+    // Hemisphere rays per record, stratified in polar angle and azimuth
+    static const int THETA = 8, PHI = 24;
+
+    // Records are used where their weight is above 1 / ACCURACY; smaller is
+    // more accurate and needs more records
+    static constexpr float ACCURACY = 0.25f;
+
+    // Bounds of a record's radius (world units)
+    static constexpr float MIN_RADIUS = 0.03f, MAX_RADIUS = 0.6f;
+
+    struct Record {
+        vec3 position;
+        vec3 normal;
+        vec3 light;
+        float radius;
+        vec3 rotation[3];       // gradient of each colour channel
+        vec3 translation[3];
+        int next;               // in the cell's list, -1 at the end
+    };
+
+    IrradianceCache() : capacity(0), count(0) {}
+
+    /* Allocates room for `records` records; the cache is off until then */
+    void Reserve(int records) {
+        capacity = records;
+        pool.reset(new Record[records]);
+        heads.reset(new atomic<int>[SLOTS]);
+        Clear();
+    }
+
+    bool Enabled() const {
+        return capacity > 0;
+    }
+
+    int Size() const {
+        return count.load();
+    }
+
+    /* True once the pool has no room left; new records are then dropped */
+    bool Full() const {
+        return count.load(memory_order_relaxed) >= capacity;
+    }
+
+    /* Forgets all records. Only call while no one is reading. */
+    void Clear() {
+        for (int i = 0; capacity > 0 && i < SLOTS; i++) {
+            heads[i].store(-1, memory_order_relaxed);
+        }
+        count.store(0);
+    }
+
+    /* Interpolates the records around the position into `light`; false if
+    none is close enough */
+    bool Lookup(const vec3& position, const vec3& normal, vec3& light) const {
+        ivec3 cell = Cell(position);
+        int slots[27];
+        int n = 0;
+        for (int z = -1; z <= 1; z++) {
+            for (int y = -1; y <= 1; y++) {
+                for (int x = -1; x <= 1; x++) {
+                    slots[n++] = Slot(cell + ivec3(x, y, z));
+                }
+            }
+        }
+        sort(slots, slots + n);
+        n = unique(slots, slots + n) - slots;
+
+        vec3 sum(0, 0, 0);
+        float weights = 0;
+        for (int k = 0; k < n; k++) {
+            for (int i = heads[slots[k]].load(memory_order_acquire); i >= 0; i = pool[i].next) {
+                const Record& r = pool[i];
+                vec3 d = position - r.position;
+
+                // Skip records in front of the point, which see light the
+                // point does not
+                if (dot(d, r.normal + normal) < -0.02f * r.radius) {
+                    continue;
+                }
+
+                float error = length(d) / r.radius +
+                    sqrt(std::max(0.f, 1.f - dot(normal, r.normal)));
+                if (error >= ACCURACY) {
+                    continue;
+                }
+
+                float w = 1.f / std::max(error, 1e-4f);
+                vec3 turn = cross(r.normal, normal);
+                for (int c = 0; c < 3; c++) {
+                    sum[c] += w * (r.light[c] + dot(turn, r.rotation[c]) +
+                                   dot(d, r.translation[c]));
+                }
+                weights += w;
+            }
+        }
+
+        if (weights == 0) {
+            return false;
+        }
+        light = glm::max(sum / weights, vec3(0, 0, 0));
+        return true;
+    }
+
+    /* Adds a record; silently drops it if the pool is full */
+    void Insert(const Record& record) {
+        int index = count.load(memory_order_relaxed);
+        do {
+            if (index >= capacity) {
+                return;
+            }
+        } while (!count.compare_exchange_weak(
+            index, index + 1, memory_order_relaxed, memory_order_relaxed
+        ));
+        pool[index] = record;
+
+        atomic<int>& head = heads[Slot(Cell(record.position))];
+        int next = head.load(memory_order_relaxed);
+        do {
+            pool[index].next = next;
+        } while (!head.compare_exchange_weak(
+            next, index, memory_order_release, memory_order_relaxed
+        ));
+    }
+
+private:
+    static const int SLOTS = 1 << 16;
+
+    int capacity;
+    atomic<int> count;
+    unique_ptr<Record[]> pool;
+    unique_ptr<atomic<int>[]> heads;
+
+    static ivec3 Cell(const vec3& position) {
+        return ivec3(glm::floor(position / (ACCURACY * MAX_RADIUS)));
+    }
+
+    static int Slot(const ivec3& cell) {
+        uint32_t h = (uint32_t) cell.x * 73856093u ^
+                     (uint32_t) cell.y * 19349663u ^
+                     (uint32_t) cell.z * 83492791u;
+        return h & (SLOTS - 1);
+    }
+};
+
+#endif
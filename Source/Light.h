@@ -3,10 +3,13 @@
 
 #define GLM_FORCE_RADIANS
 
-#include <glm/gtx/vector_angle.hpp>
-#include <glm/gtx/rotate_vector.hpp>
+#include <memory>
 #include <random>
 #include "Intersection.h"
+#include "LightSet.h"
+#include "PhotonMap.h"
+#include "IrradianceCache.h"
+#include "PathGuide.h"
 
 #define TORAD(x) x * M_PI * 2.f
 
@@ -24,7 +27,7 @@ public:
 
     vec3 CalculateColor (
         const Intersection& intersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays
@@ -36,17 +39,17 @@ public:
 
         vec3 color, directLight, indirectLight;
 
-        directLight = DirectLight(intersect, primitives);
+        directLight = DirectLight(intersect, scene);
         indirectLight = vec3(0.5, 0.5, 0.5);
 
         // color = (1.f / (float)(depth + 1) * indirectLight + directLight) * triangles[intersect.triangleIndex].color;
-        color = (indirectLight + directLight) * intersect.primitive->material.diffuse;
+        color = (indirectLight + directLight) * intersect.GetMaterial().diffuse;
 
         return color;
     }
 
     virtual vec3 DirectLight (
-        const Intersection& pointIntersect, const vector<Primitive*>& primitives
+        const Intersection& pointIntersect, const Scene& scene
     ) {
         Intersection lightIntersect;
         vec3 directLight;
@@ -57,7 +60,8 @@ public:
         );
 
         bool found = Intersection::ClosestIntersection(
-            shadowRay, primitives, lightIntersect, pointIntersect.primitiveIndex
+            shadowRay, scene, lightIntersect,
+            pointIntersect.primitiveIndex, pointIntersect.faceIndex
         );
 
         // If intersection exist, no direct light, else calculate direct light
@@ -87,6 +91,23 @@ public:
     float width;
     vec3 v0, v1; // two corners of the square
 
+    // All lights of the scene, this square first, shared with the copies of
+    // this light. Build them again after adding lights.
+    shared_ptr<LightSet> lights;
+
+    // Photons that reached a diffuse surface through glass or mirrors only,
+    // and those that bounced off a diffuse surface before; shared like the
+    // lights and empty unless photons were traced
+    shared_ptr<PhotonMap> caustics, indirect;
+
+    // Bounce light at the camera's hits, shared like the lights; off until
+    // room for records is reserved
+    shared_ptr<IrradianceCache> irradiance;
+
+    // Where bounce light comes from, learned over the first passes and
+    // shared like the lights; off until reset
+    shared_ptr<PathGuide> guide;
+
     default_random_engine generator;
     uniform_real_distribution<float> distribution;
 
@@ -94,15 +115,49 @@ public:
         vec3 position,
         vec3 color,
         float width
-    ) : Light(position, color), width(width), distribution(0, 1) {
+    ) : Light(position, color), width(width), lights(new LightSet),
+        caustics(new PhotonMap), indirect(new PhotonMap),
+        irradiance(new IrradianceCache), guide(new PathGuide), distribution(0, 1) {
 
         v0 = vec3(position.x - width / 2.f, position.y, position.z - width / 2.f);
         v1 = vec3(position.x + width / 2.f, position.y, position.z + width / 2.f);
+
+        lights->Add(SquareEmitter(position, color, width));
+        lights->Build();
     }
 
+    /*
+        Shades a hit along the path specialised for its material's class,
+        which was worked out when the material was added.
+    */
     vec3 CalculateColor (
         const Intersection& pointIntersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
+        int depth,
+        int maxDepth,
+        int numRays,
+        int sample
+    ) {
+        switch (pointIntersect.GetShading()) {
+        case Material::MIRROR:
+            return Shade<Material::MIRROR>(pointIntersect, scene, depth, maxDepth, numRays, sample);
+        case Material::GLOSSY:
+            return Shade<Material::GLOSSY>(pointIntersect, scene, depth, maxDepth, numRays, sample);
+        case Material::DIELECTRIC:
+            return Shade<Material::DIELECTRIC>(pointIntersect, scene, depth, maxDepth, numRays, sample);
+        default:
+            return Shade<Material::DIFFUSE>(pointIntersect, scene, depth, maxDepth, numRays, sample);
+        }
+    }
+
+    /*
+        Shading for one class of material. The class is known at compile
+        time, so each instance only keeps the code its class needs.
+    */
+    template <Material::Shading S>
+    vec3 Shade (
+        const Intersection& pointIntersect,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays,
@@ -113,45 +168,60 @@ public:
             return vec3(0, 0, 0);
         }
 
-        vec3 color, reflect, refract, diffuse;
-
-        if (pointIntersect.primitive->material.isReflective) {
-            reflect = CalculateReflective(
-                pointIntersect, primitives, depth, maxDepth, numRays, sample
+        if (S == Material::DIFFUSE) {
+            return CalculateDiffuse(
+                pointIntersect, scene, depth, maxDepth, numRays, sample
             );
+        }
 
-            float reflectStrength = pointIntersect.primitive->material.reflectStrength;
-            if (reflectStrength < 1.f) {
-                diffuse = CalculateDiffuse(
-                    pointIntersect, primitives, depth, maxDepth, numRays, sample
-                );
+        const Material& material = pointIntersect.GetMaterial();
+        vec3 color, reflect, refract, diffuse;
 
-                color = reflect * reflectStrength + diffuse * (1 - reflectStrength);
+        if (S == Material::DIELECTRIC) {
+            // Glass is rarely hit, so its roughness is looked at here
+            if (material.refractRoughness > 0) {
+                refract = CalculateRefractive<true>(
+                    pointIntersect, scene, depth, maxDepth, numRays, sample
+                );
             } else {
-                color = reflect;
+                refract = CalculateRefractive<false>(
+                    pointIntersect, scene, depth, maxDepth, numRays, sample
+                );
             }
-        } else if (pointIntersect.primitive->material.isRefractive) {
-            refract = CalculateRefractive(
-                pointIntersect, primitives, depth, maxDepth, numRays, sample
-            );
 
-            reflect = CalculateReflective(
-                pointIntersect, primitives, depth, maxDepth, numRays, sample
-            );
+            if (material.reflectRoughness > 0) {
+                reflect = CalculateReflective<true>(
+                    pointIntersect, scene, depth, maxDepth, numRays, sample
+                );
+            } else {
+                reflect = CalculateReflective<false>(
+                    pointIntersect, scene, depth, maxDepth, numRays, sample
+                );
+            }
 
             float Fr = CalculateFresnel(
                 pointIntersect.ray.d,
                 pointIntersect.normal,
-                pointIntersect.primitive->material.ior
+                material.ior
             );
             float Ft = 1.f - Fr;
 
-            color = refract * Ft + reflect * Fr;
-            //color = vec3(1,1,1) * Fr;
-        } else {
-            color = CalculateDiffuse(
-                pointIntersect, primitives, depth, maxDepth, numRays, sample
+            return refract * Ft + reflect * Fr;
+        }
+
+        reflect = CalculateReflective<S == Material::GLOSSY>(
+            pointIntersect, scene, depth, maxDepth, numRays, sample
+        );
+
+        float reflectStrength = material.reflectStrength;
+        if (reflectStrength < 1.f) {
+            diffuse = CalculateDiffuse(
+                pointIntersect, scene, depth, maxDepth, numRays, sample
             );
+
+            color = reflect * reflectStrength + diffuse * (1 - reflectStrength);
+        } else {
+            color = reflect;
         }
 
         return color;
@@ -159,7 +229,7 @@ public:
 
     vec3 CalculateDiffuse(
         const Intersection& pointIntersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays,
@@ -167,99 +237,126 @@ public:
     ) {
         vec3 directLight, indirectLight;
 
-        directLight = DirectLight(
-            pointIntersect, primitives, depth, maxDepth, numRays, sample
-        );
-        indirectLight = IndirectLight(
-            pointIntersect, primitives, depth, maxDepth, numRays, sample
-        );
+        // The irradiance cache serves the camera's hits. With photons, only
+        // the camera's hits send out bounce rays, and the surfaces these
+        // reach look their bounce light up instead. Once the cache is full,
+        // a miss would compute a record only to drop it, so it is path
+        // traced as without the cache.
+        bool found = false, cached = irradiance->Enabled() && depth == 0;
+        if (cached) {
+            found = irradiance->Lookup(pointIntersect.position, pointIntersect.normal, indirectLight);
+            cached = found || !irradiance->Full();
+        }
+
+        if (cached) {
+            directLight = DirectLight(
+                pointIntersect, scene, depth, maxDepth, 0, sample
+            );
+            if (!found) {
+                indirectLight = CacheIrradiance(
+                    pointIntersect, scene, depth, maxDepth, numRays, sample
+                );
+            }
+        } else if (indirect->Empty() || depth == 0) {
+            // The bounce rays add the light they happen to see to directLight
+            directLight = DirectLight(
+                pointIntersect, scene, depth, maxDepth, numRays, sample
+            );
+            indirectLight = IndirectLight(
+                pointIntersect, scene, depth, maxDepth, numRays, sample, directLight
+            );
+        } else {
+            directLight = DirectLight(
+                pointIntersect, scene, depth, maxDepth, 0, sample
+            );
+            indirectLight = indirect->Estimate(pointIntersect.position, pointIntersect.normal);
+        }
+
+        // Light focused by glass and mirrors is never found by the rays
+        indirectLight += caustics->Estimate(pointIntersect.position, pointIntersect.normal);
 
-        return (indirectLight + directLight) * pointIntersect.primitive->material.diffuse;
+        return (indirectLight + directLight) * pointIntersect.GetMaterial().diffuse;
     }
 
+    template <bool Rough>
     vec3 CalculateReflective(
         const Intersection& pointIntersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays,
         int sample
     ) {
-        float reflectRoughness = pointIntersect.primitive->material.reflectRoughness;
-        vec3 dir = CalculateReflectionVector(
-            pointIntersect.ray.d, pointIntersect.normal
-        );
+        const Material& material = pointIntersect.GetMaterial();
 
-        float product = dot(normalize(this->position - pointIntersect.position), normalize(dir));
-        float specular = pow(product > 0 ? product : 0, pointIntersect.primitive->material.specularExponent);
+        // Only loop once if the material is mirror
+        int rays = Rough ? numRays : 1;
 
         vec3 reflect (0, 0, 0);
-        for (int i = 0; i < numRays; i++) {
-            dir = pointOnCone(dir, reflectRoughness);
+        for (int i = 0; i < rays; i++) {
+            float weight;
+            vec3 dir = sampleMicrofacet<Rough>(
+                pointIntersect.ray.d, pointIntersect.normal, material.reflectRoughness,
+                false, 1, weight
+            );
+            if (weight == 0) {
+                continue;
+            }
 
             Ray ray (pointIntersect.position + dir * 0.0001f, dir);
 
             Intersection intersect;
             bool found = Intersection::ClosestIntersection(
-                ray, primitives, intersect, -1
+                ray, scene, intersect, -1
             );
 
             if (found) {
-                reflect += CalculateColor(
-                    intersect, primitives, depth + 1, maxDepth, numRays, sample
+                reflect += weight * CalculateColor(
+                    intersect, scene, depth + 1, maxDepth, numRays, sample
                 );
-            } else {
-                reflect += vec3 (0, 0, 0);
-            }
-
-            // Only loop once if the material is mirror
-            if (reflectRoughness == 0) {
-                numRays = 1;
-                break;
             }
         }
-        reflect /= numRays;
-        return reflect * specular;
+        reflect /= (float) rays;
+        return reflect;
     }
 
+    template <bool Rough>
     vec3 CalculateRefractive(
         const Intersection& pointIntersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays,
         int sample
     ) {
         vec3 color(0, 0, 0);
-        float refractRoughness = pointIntersect.primitive->material.refractRoughness;
-        vec3 T = CalculateRefractionVector(
-            pointIntersect.primitive->material.ior,
-            pointIntersect.normal,
-            pointIntersect.ray.d
-        );
-
-        for (int i = 0; i < numRays; i++) {
-            vec3 dir = pointOnCone(T, refractRoughness);
+        const Material& material = pointIntersect.GetMaterial();
+        int rays = Rough ? numRays : 1;
+
+        for (int i = 0; i < rays; i++) {
+            float weight;
+            vec3 dir = sampleMicrofacet<Rough>(
+                pointIntersect.ray.d, pointIntersect.normal, material.refractRoughness,
+                true, material.ior, weight
+            );
+            if (weight == 0) {
+                continue;
+            }
             Ray ray (pointIntersect.position + dir * 0.0001f, dir);
 
             Intersection intersect;
             bool found = Intersection::ClosestIntersection(
-                ray, primitives, intersect, -1
+                ray, scene, intersect, -1
             );
 
             if (found) {
-                color = CalculateColor(
-                    intersect, primitives, depth + 1, maxDepth, numRays, sample
+                color += weight * CalculateColor(
+                    intersect, scene, depth + 1, maxDepth, numRays, sample
                 );
-            } else {
-                color = vec3 (0, 0, 0);
-            }
-
-            if (refractRoughness == 0) {
-                break;
             }
         }
 
+        color /= (float) rays;
         return color;
     }
 
@@ -329,71 +426,315 @@ public:
         }
     }
 
-    vec3 DirectLight(
+    /*
+        Bounce light at a diffuse hit from a stratified hemisphere of rays,
+        which is added to the irradiance cache with its gradients. The
+        gradients are those for cosine-distributed strata from Krivanek and
+        Gautron, "Practical Global Illumination with Irradiance Caching",
+        divided by pi like the light.
+    */
+    vec3 CacheIrradiance(
         const Intersection& pointIntersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays,
         int sample
     ) {
-        Intersection intersect;
-        vec3 directLight(0, 0, 0);
-        float gridWidth = width / (float) sample;
-
-        for (float z = v0.z; z < v1.z; z += gridWidth) {
-            for (float x = v0.x; x < v1.x; x += gridWidth) {
-                float dX = gridWidth * distribution(generator);
-                float dZ = gridWidth * distribution(generator);
-                vec3 lightPos(x + dX, v0.y, z + dZ);
-
-                // Create direct ray towards light source
-                Ray shadowRay (
-                    pointIntersect.position, lightPos - pointIntersect.position
+        const int M = IrradianceCache::THETA, N = IrradianceCache::PHI;
+        vec3 L[M][N];
+        float R[M][N];
+        vec3 tangent, bitangent;
+        basis(pointIntersect.normal, tangent, bitangent);
+
+        IrradianceCache::Record record;
+        record.light = vec3(0, 0, 0);
+        float inverseDistances = 0;
+        for (int j = 0; j < M; j++) {
+            for (int k = 0; k < N; k++) {
+                float u = (j + distribution(generator)) / M;
+                float phi = (k + distribution(generator)) * 2.f * M_PI / N;
+                float sinTheta = sqrt(u);
+                vec3 direction = normalize(
+                    tangent * (sinTheta * cos(phi)) + bitangent * (sinTheta * sin(phi)) +
+                    pointIntersect.normal * sqrt(1.f - u)
                 );
 
+                Intersection inter;
                 bool found = Intersection::ClosestIntersection(
-                    shadowRay, primitives, intersect, pointIntersect.primitiveIndex
+                    Ray(pointIntersect.position, direction), scene, inter,
+                    pointIntersect.primitiveIndex, pointIntersect.faceIndex
                 );
-
-                // If intersection exist, no direct light, else calculate direct light
-                if (
-                    found &&
-                    distance(intersect.position, pointIntersect.position) <
-                    distance(lightPos, pointIntersect.position)
-                ) {
-                    // directLight += vec3(0, 0, 0);
+                if (found) {
+                    L[j][k] = CalculateColor(inter, scene, depth + 1, maxDepth, numRays, sample);
+                    R[j][k] = distance(inter.position, pointIntersect.position);
+                    inverseDistances += 1.f / R[j][k];
                 } else {
-                    vec3 R = lightPos - pointIntersect.position;
-                    float r = length(R);
-                    float product = dot(R, pointIntersect.normal);
-                    if (product < 0) {
-                        product = 0;
+                    L[j][k] = vec3(0, 0, 0);
+                    R[j][k] = numeric_limits<float>::max();
+                }
+                record.light += L[j][k];
+            }
+        }
+        record.light /= (float) (M * N);
+
+        for (int c = 0; c < 3; c++) {
+            record.rotation[c] = vec3(0, 0, 0);
+            record.translation[c] = vec3(0, 0, 0);
+        }
+        for (int k = 0; k < N; k++) {
+            float phi = (k + 0.5f) * 2.f * M_PI / N;
+            float phiMinus = k * 2.f * M_PI / N;
+            vec3 uK = tangent * cos(phi) + bitangent * sin(phi);
+            vec3 vK = bitangent * cos(phi) - tangent * sin(phi);
+            vec3 vKMinus = bitangent * cos(phiMinus) - tangent * sin(phiMinus);
+            int kMinus = (k + N - 1) % N;
+
+            for (int j = 0; j < M; j++) {
+                float sinMinus = sqrt(j / (float) M), cosMinus = sqrt(1.f - j / (float) M);
+                float cosPlus = sqrt(1.f - (j + 1) / (float) M);
+                float sinCentre = sqrt((j + 0.5f) / M), cosCentre = sqrt(1.f - (j + 0.5f) / M);
+
+                vec3 rotation = vK * (-sinCentre / cosCentre / (M * N));
+                vec3 translation =
+                    vKMinus * ((cosPlus - cosMinus) /
+                               (sinCentre * std::min(R[j][k], R[j][kMinus]) * (float) M_PI));
+                for (int c = 0; c < 3; c++) {
+                    record.rotation[c] += rotation * L[j][k][c];
+                    record.translation[c] += translation * (L[j][k][c] - L[j][kMinus][c]);
+                }
+
+                if (j > 0) {
+                    vec3 polar = uK * (2.f / N * sinMinus * cosMinus * cosMinus /
+                                       std::min(R[j][k], R[j - 1][k]));
+                    for (int c = 0; c < 3; c++) {
+                        record.translation[c] += polar * (L[j][k][c] - L[j - 1][k][c]);
                     }
+                }
+            }
+        }
 
-                    directLight += (this->color * product) / (float) (4.0 * M_PI * r * r);
+        // Harmonic mean distance to the surroundings, no larger than the
+        // distance over which the gradient would change the light by all of
+        // it
+        vec3 luminance(0.2126f, 0.7152f, 0.0722f);
+        float radius = inverseDistances > 0 ? M * N / inverseDistances : IrradianceCache::MAX_RADIUS;
+        float gradient = length(
+            record.translation[0] * luminance.x + record.translation[1] * luminance.y +
+            record.translation[2] * luminance.z
+        );
+        if (gradient > 0) {
+            radius = std::min(radius, dot(record.light, luminance) / gradient);
+        }
+        record.radius = glm::clamp(radius, IrradianceCache::MIN_RADIUS, IrradianceCache::MAX_RADIUS);
+        record.position = pointIntersect.position;
+        record.normal = pointIntersect.normal;
+
+        irradiance->Insert(record);
+        return record.light;
+    }
+
+    /*
+        Traces `count` photons from the lights. Those that land on a diffuse
+        surface are added to `caustic` if they only passed glass and mirrors
+        on the way, and to `bounced` if they came off a diffuse surface.
+        `total` is the number of photons traced by all callers together.
+
+        The power of a photon is set where it first lands, so that photons
+        arriving straight from the lights would add up to DirectLight; it
+        then only changes with the colours it bounces off.
+    */
+    void TracePhotons(
+        const Scene& scene,
+        int count,
+        int total,
+        int maxDepth,
+        vector<Photon>& caustic,
+        vector<Photon>& bounced
+    ) {
+        for (int n = 0; n < count; n++) {
+            int index = lights->Pick(distribution(generator), distribution(generator));
+            const SquareEmitter& emitter = lights->emitters[index];
+
+            // Any direction; the lights shine both ways
+            float z = 1.f - 2.f * distribution(generator);
+            float phi = distribution(generator) * 2.f * M_PI;
+            float r = sqrt(std::max(0.f, 1.f - z * z));
+            vec3 dir(r * cos(phi), r * sin(phi), z);
+
+            Ray ray(emitter.Point(distribution(generator), distribution(generator)), dir);
+            vec3 power = emitter.color / (total * lights->Pdf(index));
+            float travelled = 0;
+            bool landed = false, specular = false, diffuse = false;
+            int ignoreIndex = -1, ignoreFace = -1;
+
+            for (int depth = 0; depth <= maxDepth; depth++) {
+                Intersection hit;
+                if (!Intersection::ClosestIntersection(ray, scene, hit, ignoreIndex, ignoreFace)) {
+                    break;
+                }
+                const Material& material = hit.GetMaterial();
+
+                if (!landed) {
+                    travelled += distance(ray.s, hit.position);
+                }
+
+                // Glass reflects or refracts in proportion to the Fresnel term
+                if (material.isRefractive) {
+                    float Fr = CalculateFresnel(ray.d, hit.normal, material.ior);
+                    vec3 T = CalculateRefractionVector(material.ior, hit.normal, ray.d);
+                    float weight;
+                    if (distribution(generator) < Fr || T == vec3(0, 0, 0)) {
+                        dir = sampleMicrofacet(
+                            ray.d, hit.normal, material.reflectRoughness, false, 1, weight
+                        );
+                    } else {
+                        dir = sampleMicrofacet(
+                            ray.d, hit.normal, material.refractRoughness, true, material.ior, weight
+                        );
+                    }
+                    if (weight == 0) {
+                        break;
+                    }
+                    power *= weight;
+                    ray = Ray(hit.position + dir * 0.0001f, dir);
+                    ignoreIndex = ignoreFace = -1;
+                    specular = true;
+                    continue;
                 }
+
+                float reflectStrength = material.isReflective ? material.reflectStrength : 0.f;
+                if (reflectStrength < 1) {
+                    if (!landed) {
+                        power *= travelled;
+                        landed = true;
+                    }
+                    Photon photon = { hit.position, hit.normal, power };
+                    if (diffuse) {
+                        bounced.push_back(photon);
+                    } else if (specular) {
+                        caustic.push_back(photon);
+                    }
+                }
+
+                // Mirror with probability reflectStrength, otherwise diffuse
+                // with probability of the albedo's average
+                float u = distribution(generator);
+                if (u < reflectStrength) {
+                    float weight;
+                    dir = sampleMicrofacet(
+                        ray.d, hit.normal, material.reflectRoughness, false, 1, weight
+                    );
+                    if (weight == 0) {
+                        break;
+                    }
+                    power *= weight;
+                    ray = Ray(hit.position + dir * 0.0001f, dir);
+                    ignoreIndex = ignoreFace = -1;
+                    specular = true;
+                    continue;
+                }
+
+                const vec3& albedo = material.diffuse;
+                float survive = (1 - reflectStrength) * (albedo.x + albedo.y + albedo.z) / 3;
+                if (u >= reflectStrength + survive) {
+                    break;
+                }
+                power *= albedo * ((1 - reflectStrength) / survive);
+                diffuse = true;
+                ray = Ray(hit.position, pointOnHemisphere(hit.normal));
+                ignoreIndex = hit.primitiveIndex;
+                ignoreFace = hit.faceIndex;
+            }
+        }
+    }
+
+    /*
+        Direct light from `sample` random points on lights picked by their
+        power. Together with
+        the bounce rays of IndirectLight, which count the light when they
+        hit it, this combines light and BSDF sampling with multiple
+        importance sampling, so the number of shadow rays per hit is fixed.
+    */
+    vec3 DirectLight(
+        const Intersection& pointIntersect,
+        const Scene& scene,
+        int depth,
+        int maxDepth,
+        int numRays,
+        int sample
+    ) {
+        Intersection intersect;
+        vec3 directLight(0, 0, 0);
+
+        for (int i = 0; i < sample; i++) {
+            int index = lights->Pick(distribution(generator), distribution(generator));
+            const SquareEmitter& emitter = lights->emitters[index];
+            vec3 lightPos = emitter.Point(distribution(generator), distribution(generator));
+
+            // Create direct ray towards light source
+            Ray shadowRay (
+                pointIntersect.position, lightPos - pointIntersect.position
+            );
+
+            bool found = Intersection::ClosestIntersection(
+                shadowRay, scene, intersect,
+                pointIntersect.primitiveIndex, pointIntersect.faceIndex
+            );
+
+            // If intersection exist, no direct light, else calculate direct light
+            if (
+                !found ||
+                distance(intersect.position, pointIntersect.position) >=
+                distance(lightPos, pointIntersect.position)
+            ) {
+                directLight += WeightedLight(
+                    pointIntersect, emitter, lightPos, lights->Pdf(index), sample, numRays
+                );
             }
         }
 
-        directLight /= (float) sample * sample;
         return directLight;
     }
 
+    /*
+        Bounce light from numRays rays, cosine-distributed or, once the path
+        guide has learned something, half of them sent where it says. Rays
+        add the weighted share of direct light of every light they pass
+        through before hitting something to directLight; lights are not part
+        of the scene, so the rays carry on through them.
+    */
     vec3 IndirectLight(
         const Intersection& pointIntersect,
-        const vector<Primitive*>& primitives,
+        const Scene& scene,
         int depth,
         int maxDepth,
         int numRays,
-        int sample
+        int sample,
+        vec3& directLight
     ) {
         vec3 color(0, 0, 0);
+        bool guided = guide->Ready();
 
-        // cout << numRays * (1.f / (depth + 1)) << endl;
         for (int i = 0; i < numRays; i++) {
-            // Get random sample from hemisphere
-            vec3 direction = pointOnHemisphere(pointIntersect.normal);
+            // Get random sample from hemisphere, or from the guide
+            vec3 direction;
+            if (guided && distribution(generator) < PathGuide::SAMPLE_SHARE) {
+                direction = guide->Sample(
+                    pointIntersect.position, distribution(generator), distribution(generator)
+                );
+            } else {
+                direction = pointOnHemisphere(pointIntersect.normal);
+            }
+
+            // The guide may point into the surface, where no light comes
+            // from; mirror such rays out of it
+            float cosine = dot(direction, pointIntersect.normal);
+            if (cosine < 0) {
+                direction -= 2.f * cosine * pointIntersect.normal;
+                cosine = -cosine;
+            }
+            float density = BounceDensity(pointIntersect, direction);
 
             Ray ray (
                 pointIntersect.position,
@@ -402,53 +743,192 @@ public:
 
             Intersection inter;
             bool found = Intersection::ClosestIntersection(
-                ray, primitives, inter, pointIntersect.primitiveIndex
+                ray, scene, inter,
+                pointIntersect.primitiveIndex, pointIntersect.faceIndex
             );
 
+            lights->Hits(
+                pointIntersect.position, direction,
+                found ? distance(inter.position, pointIntersect.position)
+                      : numeric_limits<float>::max(),
+                [&](int index, float t) {
+                    directLight += WeightedLight(
+                        pointIntersect, lights->emitters[index],
+                        pointIntersect.position + t * direction,
+                        lights->Pdf(index), sample, numRays
+                    );
+                }
+            );
+
+            vec3 light(0, 0, 0);
             if (found) {
-                color += CalculateColor(inter, primitives, depth + 1, maxDepth, numRays, sample);
-            } else {
-                // color += vec3(0, 0, 0);
+                light = CalculateColor(inter, scene, depth + 1, maxDepth, numRays, sample);
+                color += light * (cosine / (float) M_PI / density);
+            }
+
+            // The guide learns the light times the cosine, which is what
+            // the rays should follow
+            if (guide->Recording()) {
+                guide->Record(
+                    pointIntersect.position, direction,
+                    dot(light, vec3(0.2126f, 0.7152f, 0.0722f)) * cosine / density
+                );
             }
         }
 
         color /= (float) numRays;
         return color;
     }
+
+    /*
+        Density per solid angle with which IndirectLight sends a bounce ray
+        in the unit vector `direction`, which must not point into the
+        surface. A guided ray gets there from the direction itself or from
+        its mirror image below the surface.
+    */
+    float BounceDensity(const Intersection& pointIntersect, const vec3& direction) const {
+        float cosine = dot(direction, pointIntersect.normal);
+        if (!guide->Ready()) {
+            return std::max(cosine, 0.f) / (float) M_PI;
+        }
+        vec3 mirrored = direction - 2.f * cosine * pointIntersect.normal;
+        return PathGuide::SAMPLE_SHARE * (
+                   guide->Pdf(pointIntersect.position, direction) +
+                   guide->Pdf(pointIntersect.position, mirrored)
+               ) +
+               (1 - PathGuide::SAMPLE_SHARE) * std::max(cosine, 0.f) / (float) M_PI;
+    }
+
+    /*
+        Light arriving from lightPos on the emitter, for one of lightSamples
+        points drawn on an emitter picked with probability pdf and uniformly
+        on it, or one of bounceSamples rays drawn with BounceDensity,
+        weighted by the balance heuristic: the light's integrand over the
+        sum of both strategies' densities. Written out so that nothing is
+        divided by the cosine at the light, which may be zero.
+    */
+    vec3 WeightedLight(
+        const Intersection& pointIntersect,
+        const SquareEmitter& emitter,
+        const vec3& lightPos,
+        float pdf,
+        int lightSamples,
+        int bounceSamples
+    ) {
+        vec3 R = lightPos - pointIntersect.position;
+        float r = length(R);
+        float cosine = std::max(dot(R, pointIntersect.normal) / r, 0.f);
+        float lightCosine = fabsf(R.y) / r;
+        float density = bounceSamples > 0 ? BounceDensity(pointIntersect, R / r) : 0.f;
+
+        return emitter.color * cosine * r / (float) (4.0 * M_PI * (
+            lightSamples * pdf * r * r +
+            bounceSamples * emitter.Area() * lightCosine * density
+        ));
+    }
 private:
+    /*
+        Unit vector around the normal with density cos / pi, so that the
+        average of the light along such rays is the diffuse reflection.
+    */
     vec3 pointOnHemisphere(const vec3& normal) {
-        vec3 sampledPoint;
-        float rightAng = M_PI / 2.f;
-        float theta;
-        do {
-            float u = distribution(generator)*2.f*M_PI;
-            float v = distribution(generator)*2.f*M_PI;
-
-            sampledPoint = rotateY(rotateZ(vec3(0, 1, 0), u), v);
-
-            theta = angle(sampledPoint, normal);
-        } while (theta >= rightAng);
-        return sampledPoint;
+        vec3 tangent, bitangent;
+        basis(normal, tangent, bitangent);
+
+        float phi = distribution(generator) * 2.f * M_PI;
+        float r2 = distribution(generator);
+        float r = sqrt(r2);
+
+        return normalize(
+            tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) +
+            normal * sqrt(1.f - r2)
+        );
     }
 
-    vec3 pointOnCone(const vec3& centre, float spread) {
-        vec3 point;
-        vec3 normCentre = normalize(centre);
-        vec3 up = vec3(0, 1, 0);
+    /*
+        Two unit vectors that make an orthonormal basis with the normal.
+    */
+    void basis(const vec3& normal, vec3& tangent, vec3& bitangent) {
+        tangent = normalize(cross(
+            fabsf(normal.x) > 0.5f ? vec3(0, 1, 0) : vec3(1, 0, 0), normal
+        ));
+        bitangent = cross(normal, tangent);
+    }
 
-        float u = distribution(generator) * spread;
-        float v = distribution(generator) * spread;
+    /*
+        Reflects or refracts the ray direction `d` about the normal of a
+        microfacet drawn from the GGX distribution with the given roughness
+        (alpha), with density D(m) (m . n), so that a rough surface sends
+        rays where it reflects most. `weight` is what the light along the
+        returned direction is to be multiplied by, Walter et al.'s
+        |d . m| G / (|d . n| (m . n)) with the Fresnel term left to the
+        caller; it is 0 if the ray does not leave on the right side. With
+        roughness 0 this is a perfect mirror or clear glass, weight 1.
+    */
+    vec3 sampleMicrofacet(
+        const vec3& d, const vec3& normal, float roughness, bool refract,
+        float ior, float& weight
+    ) {
+        if (roughness > 0) {
+            return sampleMicrofacet<true>(d, normal, roughness, refract, ior, weight);
+        }
+        return sampleMicrofacet<false>(d, normal, roughness, refract, ior, weight);
+    }
 
-        float theta = angle(up, normCentre);
-        vec3 axis = cross(up, normCentre);
+    /*
+        The same for roughness known to be above 0 (Rough) or 0, so that
+        mirrors and clear glass skip the sampling.
+    */
+    template <bool Rough>
+    vec3 sampleMicrofacet(
+        const vec3& d, const vec3& normal, float roughness, bool refract,
+        float ior, float& weight
+    ) {
+        vec3 I = normalize(d);
+
+        // Normal on the side the ray comes from
+        bool outside = dot(I, normal) < 0;
+        vec3 n = outside ? normal : -normal;
+        vec3 m = n;
+        if (Rough) {
+            vec3 tangent, bitangent;
+            basis(n, tangent, bitangent);
+
+            float u = distribution(generator);
+            float phi = distribution(generator) * 2.f * M_PI;
+            float cos2 = (1 - u) / (1 + (roughness * roughness - 1) * u);
+            float sinTheta = sqrt(std::max(0.f, 1 - cos2));
+            m = tangent * (sinTheta * cos(phi)) + bitangent * (sinTheta * sin(phi)) +
+                n * sqrt(cos2);
+        }
 
-        point = normalize(vec3(u, 1, v));
+        // Microfacets facing away from the ray are not hit by it
+        vec3 o;
+        if (refract) {
+            // The refraction vector tells entering from leaving by the
+            // side the normal is on
+            o = CalculateRefractionVector(ior, outside ? m : -m, I);
+            weight = dot(I, m) < 0 && o != vec3(0, 0, 0) && dot(o, n) < 0 ? 1.f : 0.f;
+        } else {
+            o = CalculateReflectionVector(I, m);
+            weight = dot(I, m) < 0 && dot(o, n) > 0 ? 1.f : 0.f;
+        }
 
-        if (length(axis) != 0) {
-            point = rotate(point, theta, axis);
+        if (Rough && weight > 0) {
+            weight = fabsf(dot(I, m)) * smithG1(I, n, roughness) * smithG1(o, n, roughness) /
+                     (fabsf(dot(I, n)) * dot(m, n));
         }
+        return o;
+    }
 
-        return point;
+    /*
+        Smith's shadowing term for GGX: the share of microfacets seen from
+        the direction v that are not hidden by others.
+    */
+    float smithG1(const vec3& v, const vec3& n, float roughness) {
+        float c2 = dot(v, n) * dot(v, n);
+        float tan2 = (1 - c2) / std::max(c2, 1e-8f);
+        return 2.f / (1.f + sqrt(1.f + roughness * roughness * tan2));
     }
 };
 #endif
@@ -0,0 +1,183 @@
+#ifndef __H_LIGHTSET_H__
+#define __H_LIGHTSET_H__
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include "BVH.h"
+
+using namespace std;
+using namespace glm;
+
+/* Horizontal square that emits light both ways. As with the original single
+light, `color` is the light's whole output, whatever its size. */
+struct SquareEmitter {
+    vec3 position;
+    vec3 color;
+    float width;
+    vec3 v0, v1;    // two corners of the square
+
+    SquareEmitter(vec3 position, vec3 color, float width)
+    : position(position), color(color), width(width) {
+        v0 = vec3(position.x - width / 2.f, position.y, position.z - width / 2.f);
+        v1 = vec3(position.x + width / 2.f, position.y, position.z + width / 2.f);
+    }
+
+    float Area() const {
+        return width * width;
+    }
+
+    /* Point on the square for two numbers in [0, 1) */
+    vec3 Point(float u, float v) const {
+        return vec3(v0.x + width * u, v0.y, v0.z + width * v);
+    }
+
+    /* Sets t and returns true if the ray s + t * d hits the square at some
+    0 < t < closest */
+    bool Intersect(const vec3& s, const vec3& d, float closest, float& t) const {
+        t = (v0.y - s.y) / d.y;
+        if (!(t > 0 && t < closest)) {
+            return false;
+        }
+        vec3 p = s + t * d;
+        return p.x >= v0.x && p.x <= v1.x && p.z >= v0.z && p.z <= v1.z;
+    }
+};
+
+/* Walker's alias method: after Build(), picks index i with probability
+weights[i] / sum(weights) from two random numbers in constant time */
+class AliasTable {
+public:
+    void Build(const vector<float>& weights) {
+        int n = weights.size();
+        float sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += weights[i];
+        }
+
+        // Without any weight, pick uniformly
+        probability.resize(n);
+        pdf.resize(n);
+        alias.resize(n);
+        vector<float> scaled(n);
+        vector<int> small, large;
+        for (int i = 0; i < n; i++) {
+            pdf[i] = sum > 0 ? weights[i] / sum : 1.f / n;
+            scaled[i] = pdf[i] * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        // Fill each under-full column with the rest from an over-full one
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            probability[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // Only rounding is left over
+        for (size_t i = 0; i < small.size(); i++) {
+            probability[small[i]] = 1;
+            alias[small[i]] = small[i];
+        }
+        for (size_t i = 0; i < large.size(); i++) {
+            probability[large[i]] = 1;
+            alias[large[i]] = large[i];
+        }
+    }
+
+    int Sample(float u1, float u2) const {
+        int n = probability.size();
+        int i = std::min((int) (u1 * n), n - 1);
+        return u2 < probability[i] ? i : alias[i];
+    }
+
+    /* Probability of picking i */
+    float Pdf(int i) const {
+        return pdf[i];
+    }
+
+private:
+    vector<float> probability;
+    vector<int> alias;
+    vector<float> pdf;
+};
+
+/* The scene's lights. Shading picks one in proportion to its power through
+an alias table, and finds the ones a bounce ray passes through with a BVH,
+so that neither has to loop over all of them. Call Build() after adding
+lights. */
+class LightSet {
+public:
+    vector<SquareEmitter> emitters;
+
+    void Add(const SquareEmitter& emitter) {
+        emitters.push_back(emitter);
+    }
+
+    void Build() {
+        vector<vec3> lo, hi;
+        for (size_t i = 0; i < emitters.size(); i++) {
+            lo.push_back(emitters[i].v0);
+            hi.push_back(emitters[i].v1);
+        }
+        // With too many lights for a BVH, Hits() tests all of them
+        vector<int> order;
+        if (!bvh.Build(lo, hi, order)) {
+            order.resize(emitters.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                order[i] = i;
+            }
+        }
+
+        vector<SquareEmitter> sorted;
+        vector<float> power;
+        for (size_t i = 0; i < order.size(); i++) {
+            const SquareEmitter& e = emitters[order[i]];
+            sorted.push_back(e);
+            power.push_back(dot(e.color, vec3(0.2126f, 0.7152f, 0.0722f)));
+        }
+        emitters.swap(sorted);
+        selection.Build(power);
+    }
+
+    /* Index of a light picked with probability Pdf(index) */
+    int Pick(float u1, float u2) const {
+        return selection.Sample(u1, u2);
+    }
+
+    float Pdf(int index) const {
+        return selection.Pdf(index);
+    }
+
+    /* Calls visit(index, t) for every light the ray s + t * d passes through
+    before `closest`. Lights do not block each other or anything else. */
+    template <typename Visit>
+    void Hits(const vec3& s, const vec3& d, float closest, Visit visit) const {
+        auto test = [&](int i) {
+            float t;
+            if (emitters[i].Intersect(s, d, closest, t)) {
+                visit(i, t);
+            }
+        };
+        if (bvh.Empty()) {
+            for (size_t i = 0; i < emitters.size(); i++) {
+                test(i);
+            }
+        } else {
+            bvh.Traverse(s, d, closest, test);
+        }
+    }
+
+private:
+    BVH bvh;
+    AliasTable selection;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __H_MAPPEDFILE_H__
+#define __H_MAPPEDFILE_H__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+
+/* Read-only memory mapping of a whole file. Pages are read from disk on
+first access, so opening even a very large file is cheap. Since nothing is
+ever written to the mapping, any page of it can be dropped and read back in
+later (see Pager). The file stays open, so that its pages can be dropped
+from the page cache too. */
+class MappedFile {
+public:
+    const char* data;
+    size_t size;
+    int fd;
+
+    MappedFile() : data(NULL), size(0), fd(-1) {}
+
+    ~MappedFile() {
+        Close();
+    }
+
+    bool Open(const char* filename) {
+        Close();
+
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            Close();
+            return false;
+        }
+
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            Close();
+            return false;
+        }
+
+        data = (const char*) p;
+        size = st.st_size;
+        return true;
+    }
+
+    void Close() {
+        if (data != NULL) {
+            munmap((void*) data, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        data = NULL;
+        size = 0;
+        fd = -1;
+    }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+#endif
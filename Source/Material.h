@@ -1,14 +1,25 @@
 #ifndef __H_Material_H__
 #define __H_Material_H__
 
+#include <cstdint>
+#include <vector>
+
+/* Index of a material in the MaterialTable */
+typedef uint16_t MaterialId;
+
 class Material {
 public:
+    /* Which shading path a material takes. Reflection wins over
+    refraction, as it always has in the shading code. */
+    enum Shading { DIFFUSE, MIRROR, GLOSSY, DIELECTRIC };
+
     vec3 diffuse;
 
+    // Roughness is the GGX alpha of the microfacets; 0 for a perfect mirror
+    // or clear glass
     bool isReflective;
     float reflectStrength;
     float reflectRoughness;
-    float specularExponent;
 
     bool isRefractive;
     float ior;
@@ -24,7 +35,6 @@ public:
         isReflective = false;
         reflectStrength = 1;
         reflectRoughness = 0;
-        specularExponent = 1;
         isRefractive = false;
         ior = 1;
         refractRoughness = 0.01;
@@ -34,6 +44,39 @@ public:
         normalMapImage = NULL;
     }
 
+    Shading Classify() const {
+        if (isReflective) {
+            return reflectRoughness > 0 ? GLOSSY : MIRROR;
+        }
+        return isRefractive ? DIELECTRIC : DIFFUSE;
+    }
+};
+
+/* All materials of the scene. Primitives and mesh faces only keep a
+MaterialId, so they stay small and traversal never has to touch material
+data; the material is looked up once a hit has been confirmed. Each
+material's shading path is worked out once, when it is added. */
+class MaterialTable {
+public:
+    static std::vector<Material> materials;
+    static std::vector<Material::Shading> shading;
+
+    static MaterialId Add(const Material& material) {
+        materials.push_back(material);
+        shading.push_back(material.Classify());
+        return materials.size() - 1;
+    }
+
+    static const Material& Get(MaterialId id) {
+        return materials[id];
+    }
+
+    static Material::Shading GetShading(MaterialId id) {
+        return shading[id];
+    }
 };
 
+std::vector<Material> MaterialTable::materials;
+std::vector<Material::Shading> MaterialTable::shading;
+
 #endif
@@ -0,0 +1,243 @@
+#ifndef __H_MESH_H__
+#define __H_MESH_H__
+
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+#include "BVH.h"
+#include "Buffer.h"
+#include "Primitive.h"
+#include "Triangle.h"
+
+using namespace std;
+using namespace glm;
+
+class Pager;
+
+/* One triangle of a Mesh, as indices into the mesh's buffers and the
+MaterialTable */
+struct MeshFace {
+    enum {
+        TWO_SIDED = 1   // back face is visible (refractive material)
+    };
+
+    int v[3];
+    int uv[3];      // -1 if the face has no texture coordinates
+    int normal;
+    MaterialId material;
+    uint16_t flags;
+};
+
+/* Indexed triangle mesh. Vertices, normals and UVs are stored once and shared
+by all faces that use them, and each face refers to its material by index,
+so a face costs 32 bytes instead of a full Triangle. The buffers may view a
+memory-mapped scene cache instead of owning their data. */
+class Mesh : public Primitive {
+public:
+    Buffer<vec3> vertices;
+    Buffer<vec3> normals;
+    Buffer<vec2> uvs;
+    Buffer<MeshFace> faces;
+
+    // Hierarchy over the faces, empty until BuildBVH() is called
+    BVH bvh;
+
+    // Residency tracking of the file the buffers are mapped from, if any
+    const Pager* pager;
+
+    Mesh() : pager(NULL) {
+        this->isMesh = true;
+    }
+
+    void Clear() {
+        vertices.clear();
+        normals.clear();
+        uvs.clear();
+        faces.clear();
+        bvh.nodes.clear();
+    }
+
+    int AddVertex(vec3 v) {
+        vertices.push_back(v);
+        return vertices.size() - 1;
+    }
+
+    /* Adds a face without texture coordinates; its normal is set by
+    ComputeNormals(). The material's settings are baked into the face flags,
+    so it must be final by now. */
+    int AddFace(int v0, int v1, int v2, MaterialId material) {
+        MeshFace f;
+        f.v[0] = v0;
+        f.v[1] = v1;
+        f.v[2] = v2;
+        f.uv[0] = f.uv[1] = f.uv[2] = -1;
+        f.normal = -1;
+        f.material = material;
+        f.flags = MaterialTable::Get(material).isRefractive ? MeshFace::TWO_SIDED : 0;
+        faces.push_back(f);
+        return faces.size() - 1;
+    }
+
+    void SetUV(int face, vec2 uv0, vec2 uv1, vec2 uv2) {
+        uvs.push_back(uv0);
+        uvs.push_back(uv1);
+        uvs.push_back(uv2);
+        for (int i = 0; i < 3; i++) {
+            faces[face].uv[i] = uvs.size() - 3 + i;
+        }
+    }
+
+    /* Recomputes the flat face normals, e.g. after the vertices moved.
+    Consecutive faces in the same plane (quads) share one normal. */
+    void ComputeNormals() {
+        normals.clear();
+        for (size_t i = 0; i < faces.size(); i++) {
+            MeshFace& f = faces[i];
+            vec3 e1 = vertices[f.v[1]] - vertices[f.v[0]];
+            vec3 e2 = vertices[f.v[2]] - vertices[f.v[0]];
+            vec3 n = normalize(cross(e2, e1));
+
+            if (normals.empty() || normals.back() != n) {
+                normals.push_back(n);
+            }
+            f.normal = normals.size() - 1;
+        }
+    }
+
+    /* Whether every index in the faces and the BVH is in range, with
+    numMaterials materials to refer to. For meshes read back from a file. */
+    bool Valid(size_t numMaterials) const {
+        for (size_t i = 0; i < faces.size(); i++) {
+            const MeshFace& f = faces[i];
+            if (f.normal < 0 || (size_t) f.normal >= normals.size() ||
+                f.material >= numMaterials) {
+                return false;
+            }
+            bool hasUVs = f.uv[0] >= 0;
+            for (int k = 0; k < 3; k++) {
+                if (f.v[k] < 0 || (size_t) f.v[k] >= vertices.size()) {
+                    return false;
+                }
+                if (hasUVs ? f.uv[k] < 0 || (size_t) f.uv[k] >= uvs.size() : f.uv[k] != -1) {
+                    return false;
+                }
+            }
+        }
+        return bvh.Valid(faces.size());
+    }
+
+    /* Box around all vertices */
+    void Bounds(vec3& lo, vec3& hi) const {
+        if (!bvh.Empty()) {
+            bvh.Bounds(lo, hi);
+            return;
+        }
+        lo = vec3(numeric_limits<float>::max());
+        hi = vec3(-numeric_limits<float>::max());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            lo = glm::min(lo, vertices[i]);
+            hi = glm::max(hi, vertices[i]);
+        }
+    }
+
+    /* Uniformly scales and moves the mesh so that it fits inside the box
+    [lo, hi], centred horizontally and resting on the hi.y side (the floor,
+    since y points down) */
+    void Fit(vec3 lo, vec3 hi) {
+        if (vertices.empty()) {
+            return;
+        }
+
+        vec3 min = vertices[0], max = vertices[0];
+        for (size_t i = 1; i < vertices.size(); i++) {
+            min = glm::min(min, vertices[i]);
+            max = glm::max(max, vertices[i]);
+        }
+
+        vec3 extent = max - min;
+        vec3 room = hi - lo;
+        float scale = std::min(room.x / extent.x, std::min(room.y / extent.y, room.z / extent.z));
+        vec3 offset(
+            (lo.x + hi.x) / 2 - (min.x + max.x) / 2 * scale,
+            hi.y - max.y * scale,
+            (lo.z + hi.z) / 2 - (min.z + max.z) / 2 * scale
+        );
+        for (size_t i = 0; i < vertices.size(); i++) {
+            vertices[i] = vertices[i] * scale + offset;
+        }
+    }
+
+    /* Builds the BVH over the faces. This reorders the faces, vertices and
+    normals, so indices taken before the call are no longer valid. Vertices
+    not used by any face are dropped. Returns false, changing nothing, if
+    there are more faces than BVH::MAX_ITEMS. */
+    bool BuildBVH() {
+        int n = faces.size();
+        vector<vec3> lo, hi;
+        FaceBounds(lo, hi);
+
+        vector<int> order;
+        if (!bvh.Build(lo, hi, order)) {
+            return false;
+        }
+
+        Buffer<MeshFace> sorted;
+        sorted.resize(n);
+        for (int i = 0; i < n; i++) {
+            sorted[i] = faces[order[i]];
+        }
+        faces = sorted;
+
+        // Store vertices and normals in the order the faces first use them,
+        // so that a subtree's geometry is close together in memory
+        vector<int> vertexMap(vertices.size(), -1), normalMap(normals.size(), -1);
+        Buffer<vec3> newVertices, newNormals;
+        newVertices.reserve(vertices.size());
+        newNormals.reserve(normals.size());
+        for (int i = 0; i < n; i++) {
+            MeshFace& f = faces[i];
+            for (int k = 0; k < 3; k++) {
+                if (vertexMap[f.v[k]] < 0) {
+                    vertexMap[f.v[k]] = newVertices.size();
+                    newVertices.push_back(vertices[f.v[k]]);
+                }
+                f.v[k] = vertexMap[f.v[k]];
+            }
+            if (normalMap[f.normal] < 0) {
+                normalMap[f.normal] = newNormals.size();
+                newNormals.push_back(normals[f.normal]);
+            }
+            f.normal = normalMap[f.normal];
+        }
+        vertices = newVertices;
+        normals = newNormals;
+        return true;
+    }
+
+    /* Box around each face, in the order the faces are stored */
+    void FaceBounds(vector<vec3>& lo, vector<vec3>& hi) const {
+        int n = faces.size();
+        lo.resize(n);
+        hi.resize(n);
+        for (int i = 0; i < n; i++) {
+            const MeshFace& f = faces[i];
+            lo[i] = glm::min(vertices[f.v[0]], glm::min(vertices[f.v[1]], vertices[f.v[2]]));
+            hi[i] = glm::max(vertices[f.v[0]], glm::max(vertices[f.v[1]], vertices[f.v[2]]));
+        }
+    }
+
+    /* Expands a face into a standalone Triangle for code that works on one
+    triangle at a time, such as the rasteriser's shaders */
+    Triangle GetTriangle(int face) const {
+        const MeshFace& f = faces[face];
+        Triangle t(vertices[f.v[0]], vertices[f.v[1]], vertices[f.v[2]], f.material);
+        t.normal = normals[f.normal];
+        if (f.uv[0] >= 0) {
+            t.setUV(uvs[f.uv[0]], uvs[f.uv[1]], uvs[f.uv[2]]);
+        }
+        return t;
+    }
+};
+
+#endif
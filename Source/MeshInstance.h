@@ -0,0 +1,75 @@
+#ifndef __H_MESHINSTANCE_H__
+#define __H_MESHINSTANCE_H__
+
+#include <limits>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+#include "Primitive.h"
+#include "Ray.h"
+
+using namespace std;
+using namespace glm;
+
+/* A placed copy of a mesh. The mesh, with its BVH, is shared by all of its
+instances; an instance only adds an affine transform, so placing an asset
+many times costs a couple of hundred bytes per copy rather than a copy of
+its geometry. Rays are moved into the mesh's space for traversal instead of
+the mesh being moved into world space. */
+class MeshInstance : public Primitive {
+public:
+    const Mesh* mesh;
+
+    // world = linear * object + translation
+    mat3 linear;
+    vec3 translation;
+
+    // The inverse, and the matrix that takes normals to world space
+    mat3 inverseLinear;
+    vec3 inverseTranslation;
+    mat3 normalToWorld;
+
+    MeshInstance(const Mesh* mesh, mat3 linear, vec3 translation) : mesh(mesh) {
+        this->isInstance = true;
+        Place(linear, translation);
+    }
+
+    /* Moves the instance. The scene's hierarchy has to be updated before
+    rays are traced again; see Scene::Update(). */
+    void Place(mat3 linear, vec3 translation) {
+        this->linear = linear;
+        this->translation = translation;
+        inverseLinear = inverse(linear);
+        inverseTranslation = -(inverseLinear * translation);
+        normalToWorld = transpose(inverseLinear);
+    }
+
+    /* Ray in the mesh's space. The direction is not renormalised, so hit
+    distances t are the same in both spaces. */
+    Ray ToObject(const Ray& ray) const {
+        return Ray(inverseLinear * ray.s + inverseTranslation, inverseLinear * ray.d);
+    }
+
+    vec3 NormalToWorld(const vec3& n) const {
+        return normalize(normalToWorld * n);
+    }
+
+    /* World space box around the mesh's box */
+    void Bounds(vec3& lo, vec3& hi) const {
+        vec3 meshLo, meshHi;
+        mesh->Bounds(meshLo, meshHi);
+        lo = vec3(numeric_limits<float>::max());
+        hi = vec3(-numeric_limits<float>::max());
+        for (int i = 0; i < 8; i++) {
+            vec3 corner(
+                i & 1 ? meshHi.x : meshLo.x,
+                i & 2 ? meshHi.y : meshLo.y,
+                i & 4 ? meshHi.z : meshLo.z
+            );
+            corner = linear * corner + translation;
+            lo = glm::min(lo, corner);
+            hi = glm::max(hi, corner);
+        }
+    }
+};
+
+#endif
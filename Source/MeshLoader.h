@@ -0,0 +1,772 @@
+#ifndef __H_MESHLOADER_H__
+#define __H_MESHLOADER_H__
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "MappedFile.h"
+#include "Mesh.h"
+
+using namespace std;
+using namespace glm;
+
+/* Loads Wavefront OBJ and binary little-endian PLY files into a Mesh. The
+file is memory-mapped and cut into one chunk per hardware thread. A first
+parallel pass counts the vertices and faces of every chunk, which gives each
+chunk its slice of the final buffers; a second parallel pass parses straight
+into those slices. Nothing is allocated per line.
+
+Normals are always recomputed as flat face normals, since that is what the
+renderers use, and every face gets the material passed to Load(). */
+class MeshLoader {
+public:
+    static bool Load(
+        const char* filename, Mesh& mesh, MaterialId material, size_t& bytes
+    ) {
+        MappedFile file;
+        if (!file.Open(filename)) {
+            cout << "Could not open " << filename << endl;
+            return false;
+        }
+        bytes = file.size;
+
+        mesh.Clear();
+
+        bool loaded;
+        if (file.size >= 4 && memcmp(file.data, "ply\n", 4) == 0) {
+            loaded = LoadPLY(file.data, file.size, mesh, material);
+        } else {
+            loaded = LoadOBJ(file.data, file.size, mesh, material);
+        }
+
+        if (!loaded) {
+            cout << "Could not parse " << filename << endl;
+            mesh.Clear();
+            return false;
+        }
+
+        ComputeNormals(mesh);
+        return true;
+    }
+
+private:
+    /* ------------------------------------------------------------------ */
+    /* Shared helpers                                                     */
+
+    static int NumThreads() {
+        int n = thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    static MeshFace MakeFace(int a, int b, int c, MaterialId material, uint16_t flags) {
+        MeshFace f;
+        f.v[0] = a;
+        f.v[1] = b;
+        f.v[2] = c;
+        f.uv[0] = f.uv[1] = f.uv[2] = -1;
+        f.normal = -1;
+        f.material = material;
+        f.flags = flags;
+        return f;
+    }
+
+    static void ComputeNormalRange(Mesh* mesh, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            MeshFace& f = mesh->faces[i];
+            vec3 e1 = mesh->vertices[f.v[1]] - mesh->vertices[f.v[0]];
+            vec3 e2 = mesh->vertices[f.v[2]] - mesh->vertices[f.v[0]];
+            vec3 n = cross(e2, e1);
+            float l = length(n);
+            mesh->normals[i] = l > 0 ? n / l : vec3(0, 0, 0);
+            f.normal = i;
+        }
+    }
+
+    /* One normal per face, computed in parallel */
+    static void ComputeNormals(Mesh& mesh) {
+        size_t n = mesh.faces.size();
+        mesh.normals.resize(n);
+
+        int numThreads = NumThreads();
+        vector<thread> threads;
+        for (int i = 0; i < numThreads; i++) {
+            threads.push_back(thread(
+                ComputeNormalRange, &mesh, n * i / numThreads, n * (i + 1) / numThreads
+            ));
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+
+    /* ------------------------------------------------------------------ */
+    /* OBJ                                                                */
+
+    struct ObjChunk {
+        const char* begin;
+        const char* end;
+
+        // Counted in the first pass
+        size_t numVertices, numUVs, numFaces;
+
+        // Where the chunk's data starts in the mesh buffers
+        size_t vertexOffset, uvOffset, faceOffset;
+
+        bool ok;
+    };
+
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static const char* SkipSpace(const char* p, const char* end) {
+        while (p < end && IsSpace(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    static const char* SkipLine(const char* p, const char* end) {
+        const char* nl = (const char*) memchr(p, '\n', end - p);
+        return nl ? nl + 1 : end;
+    }
+
+    static const char* ParseInt(const char* p, const char* end, int& value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+        int v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            v = v * 10 + (*p - '0');
+            p++;
+        }
+        value = negative ? -v : v;
+        return p;
+    }
+
+    /* Locale independent and bounded by `end`, unlike strtof */
+    static const char* ParseFloat(const char* p, const char* end, float& value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        double v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            v = v * 10 + (*p - '0');
+            p++;
+        }
+        if (p < end && *p == '.') {
+            p++;
+            double scale = 0.1;
+            while (p < end && *p >= '0' && *p <= '9') {
+                v += (*p - '0') * scale;
+                scale *= 0.1;
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            int exponent;
+            p = ParseInt(p + 1, end, exponent);
+            v *= pow(10.0, exponent);
+        }
+
+        value = (float) (negative ? -v : v);
+        return p;
+    }
+
+    /* Number of triangles a face line fans out into */
+    static size_t CountFaceTriangles(const char* p, const char* end) {
+        int corners = 0;
+        while (true) {
+            p = SkipSpace(p, end);
+            if (p >= end || *p == '\n' || *p == '#') {
+                break;
+            }
+            corners++;
+            while (p < end && !IsSpace(*p) && *p != '\n') {
+                p++;
+            }
+        }
+        return corners >= 3 ? corners - 2 : 0;
+    }
+
+    static void CountOBJ(ObjChunk* chunk) {
+        chunk->numVertices = chunk->numUVs = chunk->numFaces = 0;
+
+        const char* p = chunk->begin;
+        const char* end = chunk->end;
+        while (p < end) {
+            p = SkipSpace(p, end);
+            if (end - p >= 2 && p[0] == 'v' && IsSpace(p[1])) {
+                chunk->numVertices++;
+            } else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2])) {
+                chunk->numUVs++;
+            } else if (end - p >= 2 && p[0] == 'f' && IsSpace(p[1])) {
+                chunk->numFaces += CountFaceTriangles(p + 2, end);
+            }
+            p = SkipLine(p, end);
+        }
+    }
+
+    /* Turns a 1-based or negative (relative) OBJ index into a 0-based one */
+    static int ResolveIndex(int index, size_t defined) {
+        return index > 0 ? index - 1 : (int) defined + index;
+    }
+
+    static void ParseOBJ(ObjChunk* chunk, Mesh* mesh, MaterialId material, uint16_t flags) {
+        size_t vertex = chunk->vertexOffset;
+        size_t uv = chunk->uvOffset;
+        size_t face = chunk->faceOffset;
+        chunk->ok = true;
+
+        const char* p = chunk->begin;
+        const char* end = chunk->end;
+        while (p < end) {
+            p = SkipSpace(p, end);
+
+            if (end - p >= 2 && p[0] == 'v' && IsSpace(p[1])) {
+                vec3& v = mesh->vertices[vertex++];
+                p = ParseFloat(SkipSpace(p + 2, end), end, v.x);
+                p = ParseFloat(SkipSpace(p, end), end, v.y);
+                p = ParseFloat(SkipSpace(p, end), end, v.z);
+            } else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2])) {
+                vec2& t = mesh->uvs[uv++];
+                p = ParseFloat(SkipSpace(p + 3, end), end, t.x);
+                p = ParseFloat(SkipSpace(p, end), end, t.y);
+            } else if (end - p >= 2 && p[0] == 'f' && IsSpace(p[1])) {
+                // Fan-triangulate the polygon around its first corner
+                int corners = 0;
+                int firstV = 0, firstT = -1, prevV = 0, prevT = -1;
+                p += 2;
+                while (true) {
+                    p = SkipSpace(p, end);
+                    if (p >= end || *p == '\n' || *p == '#') {
+                        break;
+                    }
+
+                    // v, v/vt, v//vn or v/vt/vn
+                    int v, t = 0, n;
+                    p = ParseInt(p, end, v);
+                    if (p < end && *p == '/') {
+                        p++;
+                        if (p < end && *p != '/') {
+                            p = ParseInt(p, end, t);
+                        }
+                        if (p < end && *p == '/') {
+                            p = ParseInt(p + 1, end, n);
+                        }
+                    }
+
+                    v = ResolveIndex(v, vertex);
+                    t = t != 0 ? ResolveIndex(t, uv) : -1;
+                    if (v < 0 || v >= (int) mesh->vertices.size() ||
+                        t >= (int) mesh->uvs.size()) {
+                        chunk->ok = false;
+                        return;
+                    }
+
+                    if (corners == 0) {
+                        firstV = v;
+                        firstT = t;
+                    } else if (corners >= 2) {
+                        MeshFace& f = mesh->faces[face++];
+                        f = MakeFace(firstV, prevV, v, material, flags);
+                        if (firstT >= 0 && prevT >= 0 && t >= 0) {
+                            f.uv[0] = firstT;
+                            f.uv[1] = prevT;
+                            f.uv[2] = t;
+                        }
+                    }
+                    prevV = v;
+                    prevT = t;
+                    corners++;
+
+                    while (p < end && !IsSpace(*p) && *p != '\n') {
+                        p++;
+                    }
+                }
+            }
+
+            p = SkipLine(p, end);
+        }
+    }
+
+    static bool LoadOBJ(const char* data, size_t size, Mesh& mesh, MaterialId material) {
+        const char* end = data + size;
+
+        // Cut the file into chunks that end on line boundaries
+        int numThreads = NumThreads();
+        vector<ObjChunk> chunks(numThreads);
+        const char* p = data;
+        for (int i = 0; i < numThreads; i++) {
+            chunks[i].begin = p;
+            p = i == numThreads - 1 ? end : data + size * (i + 1) / numThreads;
+            if (p < chunks[i].begin) {
+                p = chunks[i].begin;
+            }
+            if (p > data && p < end && p[-1] != '\n') {
+                p = SkipLine(p, end);
+            }
+            chunks[i].end = p;
+        }
+
+        vector<thread> threads;
+        for (int i = 0; i < numThreads; i++) {
+            threads.push_back(thread(CountOBJ, &chunks[i]));
+        }
+        for (int i = 0; i < numThreads; i++) {
+            threads[i].join();
+        }
+
+        size_t numVertices = 0, numUVs = 0, numFaces = 0;
+        for (int i = 0; i < numThreads; i++) {
+            chunks[i].vertexOffset = numVertices;
+            chunks[i].uvOffset = numUVs;
+            chunks[i].faceOffset = numFaces;
+            numVertices += chunks[i].numVertices;
+            numUVs += chunks[i].numUVs;
+            numFaces += chunks[i].numFaces;
+        }
+
+        mesh.vertices.resize(numVertices);
+        mesh.uvs.resize(numUVs);
+        mesh.faces.resize(numFaces);
+
+        uint16_t flags = MaterialTable::Get(material).isRefractive ? MeshFace::TWO_SIDED : 0;
+
+        threads.clear();
+        for (int i = 0; i < numThreads; i++) {
+            threads.push_back(thread(ParseOBJ, &chunks[i], &mesh, material, flags));
+        }
+        bool ok = numFaces > 0;
+        for (int i = 0; i < numThreads; i++) {
+            threads[i].join();
+            ok = ok && chunks[i].ok;
+        }
+        return ok;
+    }
+
+    /* ------------------------------------------------------------------ */
+    /* PLY                                                                */
+
+    enum PlyType { PLY_INVALID, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+        PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+    struct PlyProperty {
+        string name;
+        PlyType type;
+        bool isList;
+        PlyType countType;
+        int offset;     // within the element, only valid for scalar properties
+    };
+
+    struct PlyElement {
+        string name;
+        size_t count;
+        vector<PlyProperty> properties;
+        int stride;     // 0 if the element contains a list
+
+        int Find(const char* name) const {
+            for (size_t i = 0; i < properties.size(); i++) {
+                if (properties[i].name == name) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+    };
+
+    static PlyType ParsePlyType(const string& s) {
+        if (s == "char" || s == "int8") return PLY_INT8;
+        if (s == "uchar" || s == "uint8") return PLY_UINT8;
+        if (s == "short" || s == "int16") return PLY_INT16;
+        if (s == "ushort" || s == "uint16") return PLY_UINT16;
+        if (s == "int" || s == "int32") return PLY_INT32;
+        if (s == "uint" || s == "uint32") return PLY_UINT32;
+        if (s == "float" || s == "float32") return PLY_FLOAT32;
+        if (s == "double" || s == "float64") return PLY_FLOAT64;
+        return PLY_INVALID;
+    }
+
+    static int PlySize(PlyType type) {
+        switch (type) {
+            case PLY_INT8: case PLY_UINT8: return 1;
+            case PLY_INT16: case PLY_UINT16: return 2;
+            case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+            case PLY_FLOAT64: return 8;
+            default: return 0;
+        }
+    }
+
+    static double ReadPly(const char* p, PlyType type) {
+        switch (type) {
+            case PLY_INT8: { int8_t v; memcpy(&v, p, 1); return v; }
+            case PLY_UINT8: { uint8_t v; memcpy(&v, p, 1); return v; }
+            case PLY_INT16: { int16_t v; memcpy(&v, p, 2); return v; }
+            case PLY_UINT16: { uint16_t v; memcpy(&v, p, 2); return v; }
+            case PLY_INT32: { int32_t v; memcpy(&v, p, 4); return v; }
+            case PLY_UINT32: { uint32_t v; memcpy(&v, p, 4); return v; }
+            case PLY_FLOAT32: { float v; memcpy(&v, p, 4); return v; }
+            case PLY_FLOAT64: { double v; memcpy(&v, p, 8); return v; }
+            default: return 0;
+        }
+    }
+
+    /* Splits the next header line into at most five words */
+    static const char* PlyHeaderLine(const char* p, const char* end, string (&words)[5]) {
+        const char* lineEnd = SkipLine(p, end);
+        for (int i = 0; i < 5; i++) {
+            p = SkipSpace(p, lineEnd);
+            const char* word = p;
+            while (p < lineEnd && !IsSpace(*p) && *p != '\n') {
+                p++;
+            }
+            words[i].assign(word, p);
+        }
+        return lineEnd;
+    }
+
+    /* Reads a vertex index, false unless it is one of the numVertices. The
+    range is checked before the conversion, which a large or negative
+    value would otherwise overflow. */
+    static bool ReadPlyIndex(const char* p, PlyType type, int numVertices, int& index) {
+        double value = ReadPly(p, type);
+        if (!(value >= 0 && value < numVertices)) {
+            return false;
+        }
+        index = (int) value;
+        return true;
+    }
+
+    struct PlyVertexJob {
+        const char* data;
+        const PlyElement* element;
+        int x, y, z, u, v;
+        Mesh* mesh;
+        size_t begin, end;
+    };
+
+    static void ParsePlyVertices(PlyVertexJob* job) {
+        const PlyElement& e = *job->element;
+        const vector<PlyProperty>& props = e.properties;
+        for (size_t i = job->begin; i < job->end; i++) {
+            const char* p = job->data + i * e.stride;
+            vec3& vertex = job->mesh->vertices[i];
+            vertex.x = ReadPly(p + props[job->x].offset, props[job->x].type);
+            vertex.y = ReadPly(p + props[job->y].offset, props[job->y].type);
+            vertex.z = ReadPly(p + props[job->z].offset, props[job->z].type);
+            if (job->u >= 0) {
+                vec2& uv = job->mesh->uvs[i];
+                uv.x = ReadPly(p + props[job->u].offset, props[job->u].type);
+                uv.y = ReadPly(p + props[job->v].offset, props[job->v].type);
+            }
+        }
+    }
+
+    struct PlyFaceJob {
+        const char* data;
+        PlyType countType, indexType;
+        int stride;
+        Mesh* mesh;
+        MaterialId material;
+        uint16_t flags;
+        bool hasUVs;
+        size_t begin, end;
+        bool ok;
+    };
+
+    /* Fast path for meshes made only of triangles, where every face record
+    has the same size and can be found without scanning the ones before it */
+    static void ParsePlyTriangles(PlyFaceJob* job) {
+        int countSize = PlySize(job->countType);
+        int indexSize = PlySize(job->indexType);
+        int numVertices = job->mesh->vertices.size();
+        job->ok = true;
+
+        for (size_t i = job->begin; i < job->end; i++) {
+            const char* p = job->data + i * job->stride;
+            if (ReadPly(p, job->countType) != 3) {
+                job->ok = false;
+                return;
+            }
+            int v[3];
+            for (int k = 0; k < 3; k++) {
+                if (!ReadPlyIndex(p + countSize + k * indexSize, job->indexType, numVertices, v[k])) {
+                    job->ok = false;
+                    return;
+                }
+            }
+            MeshFace& f = job->mesh->faces[i];
+            f = MakeFace(v[0], v[1], v[2], job->material, job->flags);
+            if (job->hasUVs) {
+                f.uv[0] = v[0];
+                f.uv[1] = v[1];
+                f.uv[2] = v[2];
+            }
+        }
+    }
+
+    /* General path: any polygon size and extra face properties. Sequential,
+    since the position of a face record depends on all records before it. */
+    static bool ParsePlyPolygons(
+        const char* p, const char* end, const PlyElement& e, int list,
+        Mesh& mesh, MaterialId material, uint16_t flags, bool hasUVs
+    ) {
+        int numVertices = mesh.vertices.size();
+        mesh.faces.clear();
+
+        for (size_t i = 0; i < e.count; i++) {
+            for (size_t k = 0; k < e.properties.size(); k++) {
+                const PlyProperty& prop = e.properties[k];
+                if (!prop.isList) {
+                    if (PlySize(prop.type) > end - p) {
+                        return false;
+                    }
+                    p += PlySize(prop.type);
+                    continue;
+                }
+
+                if (PlySize(prop.countType) > end - p) {
+                    return false;
+                }
+                // Range-checked before the conversion, since a uint32 count
+                // may not fit an int
+                double length = ReadPly(p, prop.countType);
+                p += PlySize(prop.countType);
+                int size = PlySize(prop.type);
+                if (length < 0 || length > (end - p) / size) {
+                    return false;
+                }
+                int count = (int) length;
+
+                if ((int) k == list && count > 0) {
+                    int first, prev = 0;
+                    if (!ReadPlyIndex(p, prop.type, numVertices, first)) {
+                        return false;
+                    }
+                    for (int j = 0; j < count; j++) {
+                        int v;
+                        if (!ReadPlyIndex(p + j * size, prop.type, numVertices, v)) {
+                            return false;
+                        }
+                        if (j >= 2) {
+                            mesh.faces.push_back(MakeFace(first, prev, v, material, flags));
+                            if (hasUVs) {
+                                MeshFace& f = mesh.faces.back();
+                                f.uv[0] = first;
+                                f.uv[1] = prev;
+                                f.uv[2] = v;
+                            }
+                        }
+                        prev = v;
+                    }
+                }
+                p += count * size;
+            }
+        }
+        return true;
+    }
+
+    static bool LoadPLY(const char* data, size_t size, Mesh& mesh, MaterialId material) {
+        const char* end = data + size;
+        const char* p = SkipLine(data, end);
+
+        // Header
+        vector<PlyElement> elements;
+        string words[5];
+        bool binary = false;
+        while (true) {
+            if (p >= end) {
+                return false;
+            }
+            p = PlyHeaderLine(p, end, words);
+
+            if (words[0] == "end_header") {
+                break;
+            } else if (words[0] == "format") {
+                if (words[1] != "binary_little_endian") {
+                    cout << "Only binary little-endian PLY files are supported." << endl;
+                    return false;
+                }
+                binary = true;
+            } else if (words[0] == "element") {
+                PlyElement e;
+                e.name = words[1];
+                e.count = strtoull(words[2].c_str(), NULL, 10);
+                e.stride = 0;
+                elements.push_back(e);
+            } else if (words[0] == "property" && !elements.empty()) {
+                PlyProperty prop;
+                prop.isList = words[1] == "list";
+                if (prop.isList) {
+                    prop.countType = ParsePlyType(words[2]);
+                    prop.type = ParsePlyType(words[3]);
+                    prop.name = words[4];
+                } else {
+                    prop.countType = PLY_INVALID;
+                    prop.type = ParsePlyType(words[1]);
+                    prop.name = words[2];
+                }
+                if (prop.type == PLY_INVALID || (prop.isList && prop.countType == PLY_INVALID)) {
+                    return false;
+                }
+                elements.back().properties.push_back(prop);
+            }
+        }
+        if (!binary) {
+            return false;
+        }
+
+        // Element layouts
+        for (size_t i = 0; i < elements.size(); i++) {
+            PlyElement& e = elements[i];
+            int offset = 0;
+            for (size_t k = 0; k < e.properties.size(); k++) {
+                if (e.properties[k].isList) {
+                    offset = -1;
+                    break;
+                }
+                e.properties[k].offset = offset;
+                offset += PlySize(e.properties[k].type);
+            }
+            e.stride = offset > 0 ? offset : 0;
+        }
+
+        // Locate the vertex and face elements; anything before them must
+        // have a fixed size so it can be skipped
+        const PlyElement* vertexElement = NULL;
+        const PlyElement* faceElement = NULL;
+        const char* vertexData = NULL;
+        const char* faceData = NULL;
+        for (size_t i = 0; i < elements.size(); i++) {
+            if (elements[i].name == "vertex") {
+                vertexElement = &elements[i];
+                vertexData = p;
+            } else if (elements[i].name == "face") {
+                faceElement = &elements[i];
+                faceData = p;
+                break;
+            }
+            // Compared by division, so that a huge count in a corrupt
+            // header can not overflow or point past the file
+            const PlyElement& e = elements[i];
+            if (e.count > 0 && (e.stride == 0 || e.count > (size_t) (end - p) / e.stride)) {
+                return false;
+            }
+            p += e.stride * e.count;
+        }
+        if (vertexElement == NULL || faceElement == NULL ||
+            vertexElement->count > (size_t) numeric_limits<int>::max() ||
+            faceElement->count > (size_t) numeric_limits<int>::max()) {
+            return false;
+        }
+
+        const PlyElement& ve = *vertexElement;
+        int x = ve.Find("x"), y = ve.Find("y"), z = ve.Find("z");
+        int u = ve.Find("u"), v = ve.Find("v");
+        if (u < 0 || v < 0) {
+            u = ve.Find("s");
+            v = ve.Find("t");
+        }
+        if (u < 0 || v < 0) {
+            u = ve.Find("texture_u");
+            v = ve.Find("texture_v");
+        }
+        if (x < 0 || y < 0 || z < 0) {
+            return false;
+        }
+        bool hasUVs = u >= 0 && v >= 0;
+        if (!hasUVs) {
+            u = v = -1;
+        }
+
+        mesh.vertices.resize(ve.count);
+        if (hasUVs) {
+            mesh.uvs.resize(ve.count);
+        }
+
+        // Vertices in parallel
+        int numThreads = NumThreads();
+        vector<PlyVertexJob> vertexJobs(numThreads);
+        vector<thread> threads;
+        for (int i = 0; i < numThreads; i++) {
+            PlyVertexJob& job = vertexJobs[i];
+            job.data = vertexData;
+            job.element = &ve;
+            job.x = x;
+            job.y = y;
+            job.z = z;
+            job.u = u;
+            job.v = v;
+            job.mesh = &mesh;
+            job.begin = ve.count * i / numThreads;
+            job.end = ve.count * (i + 1) / numThreads;
+            threads.push_back(thread(ParsePlyVertices, &job));
+        }
+        for (int i = 0; i < numThreads; i++) {
+            threads[i].join();
+        }
+
+        // Faces
+        const PlyElement& fe = *faceElement;
+        int list = -1;
+        for (size_t k = 0; k < fe.properties.size(); k++) {
+            if (fe.properties[k].isList) {
+                list = k;
+                break;
+            }
+        }
+        if (list < 0) {
+            return false;
+        }
+
+        uint16_t flags = MaterialTable::Get(material).isRefractive ? MeshFace::TWO_SIDED : 0;
+        const PlyProperty& indices = fe.properties[list];
+        int triangleStride = PlySize(indices.countType) + 3 * PlySize(indices.type);
+
+        bool ok = false;
+        if (fe.properties.size() == 1 && fe.count <= (size_t) (end - faceData) / triangleStride) {
+            mesh.faces.resize(fe.count);
+
+            vector<PlyFaceJob> faceJobs(numThreads);
+            threads.clear();
+            for (int i = 0; i < numThreads; i++) {
+                PlyFaceJob& job = faceJobs[i];
+                job.data = faceData;
+                job.countType = indices.countType;
+                job.indexType = indices.type;
+                job.stride = triangleStride;
+                job.mesh = &mesh;
+                job.material = material;
+                job.flags = flags;
+                job.hasUVs = hasUVs;
+                job.begin = fe.count * i / numThreads;
+                job.end = fe.count * (i + 1) / numThreads;
+                threads.push_back(thread(ParsePlyTriangles, &job));
+            }
+            ok = true;
+            for (int i = 0; i < numThreads; i++) {
+                threads[i].join();
+                ok = ok && faceJobs[i].ok;
+            }
+        }
+
+        if (!ok) {
+            ok = ParsePlyPolygons(faceData, end, fe, list, mesh, material, flags, hasUVs);
+        }
+        return ok && !mesh.faces.empty();
+    }
+};
+
+#endif
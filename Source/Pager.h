@@ -0,0 +1,162 @@
+#ifndef __H_PAGER_H__
+#define __H_PAGER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "MappedFile.h"
+
+using namespace std;
+
+/* Keeps the resident part of a memory-mapped scene cache under a cap. The
+mapping is cut into fixed-size chunks; traversal stamps every chunk it reads
+with the current epoch, and Enforce() drops the least recently stamped
+resident chunks until the cap is met. Dropped chunks are read back from the
+file by the kernel the next time a ray reaches them, so evicting is always
+safe: the mapping is read-only, and buffers that get changed copy
+themselves out of it first (see Buffer).
+
+Stamping is a read and, once per chunk and epoch, a relaxed store; it only
+happens for meshes that have a pager attached. */
+class Pager {
+public:
+    static const int CHUNK_BITS = 20;   // 1 MB chunks
+    static const size_t CHUNK_SIZE = (size_t) 1 << CHUNK_BITS;
+
+    Pager() : base(NULL), size(0), fd(-1), cap(0), numChunks(0), epoch(1),
+        evicted(0), startFaults(0) {}
+
+    /* Starts tracking the whole file, capping its resident size to `cap`
+    bytes (0 only collects statistics). The chunks start on page
+    boundaries, since the mapping does. */
+    void Attach(const MappedFile& file, size_t cap) {
+        base = file.data;
+        size = file.size;
+        fd = file.fd;
+        this->cap = cap;
+        numChunks = (size + CHUNK_SIZE - 1) >> CHUNK_BITS;
+        stamps.reset(new atomic<uint32_t>[numChunks]);
+        for (size_t i = 0; i < numChunks; i++) {
+            stamps[i].store(0, memory_order_relaxed);
+        }
+        startFaults = MajorFaults();
+    }
+
+    bool Attached() const {
+        return base != NULL;
+    }
+
+    /* Marks the chunk holding p as used now. Called by the workers. */
+    void Touch(const void* p) const {
+        size_t offset = (const char*) p - base;
+        if (offset < size) {
+            atomic<uint32_t>& stamp = stamps[offset >> CHUNK_BITS];
+            uint32_t now = epoch.load(memory_order_relaxed);
+            if (stamp.load(memory_order_relaxed) != now) {
+                stamp.store(now, memory_order_relaxed);
+            }
+        }
+    }
+
+    /* Starts a new epoch and evicts the least recently used resident chunks
+    until the resident size is within the cap. Only one thread may call
+    this. */
+    void Enforce() {
+        epoch.fetch_add(1, memory_order_relaxed);
+        if (cap == 0) {
+            return;
+        }
+
+        vector<size_t> resident;
+        size_t residentBytes = 0;
+        for (size_t i = 0; i < numChunks; i++) {
+            size_t bytes = ResidentBytes(i);
+            if (bytes > 0) {
+                resident.push_back(i);
+                residentBytes += bytes;
+            }
+        }
+        if (residentBytes <= cap) {
+            return;
+        }
+
+        // Oldest first. Chunks still in use are evicted too if need be; the
+        // rays that need them just fault them back in.
+        sort(resident.begin(), resident.end(), [&](size_t a, size_t b) {
+            return stamps[a].load(memory_order_relaxed) < stamps[b].load(memory_order_relaxed);
+        });
+        for (size_t i = 0; i < resident.size() && residentBytes > cap; i++) {
+            size_t c = resident[i];
+            residentBytes -= ResidentBytes(c);
+            // Unmap the pages, then drop them from the page cache as well so
+            // the memory is really given back
+            madvise((void*) (base + (c << CHUNK_BITS)), ChunkBytes(c), MADV_DONTNEED);
+            posix_fadvise(fd, c << CHUNK_BITS, ChunkBytes(c), POSIX_FADV_DONTNEED);
+            evicted++;
+        }
+    }
+
+    void Report() const {
+        size_t residentBytes = 0;
+        int residentChunks = 0;
+        for (size_t i = 0; i < numChunks; i++) {
+            size_t bytes = ResidentBytes(i);
+            residentBytes += bytes;
+            residentChunks += bytes > 0;
+        }
+        cout << "Geometry resident: " << residentBytes / 1e6 << " of " << size / 1e6
+             << " MB (" << residentChunks << "/" << numChunks << " chunks";
+        if (cap > 0) {
+            cout << ", cap " << cap / 1e6 << " MB";
+        }
+        cout << "), " << evicted << " chunks evicted, "
+             << MajorFaults() - startFaults << " major faults." << endl;
+    }
+
+private:
+    const char* base;
+    size_t size;
+    int fd;
+    size_t cap;
+    size_t numChunks;
+    unique_ptr<atomic<uint32_t>[]> stamps;
+    atomic<uint32_t> epoch;
+    long evicted;
+    long startFaults;
+
+    size_t ChunkBytes(size_t c) const {
+        size_t rest = size - (c << CHUNK_BITS);
+        return rest < CHUNK_SIZE ? rest : CHUNK_SIZE;
+    }
+
+    /* Bytes of a chunk currently in memory, from mincore */
+    size_t ResidentBytes(size_t c) const {
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        size_t bytes = ChunkBytes(c);
+        size_t pages = (bytes + page - 1) / page;
+        vector<unsigned char> inCore(pages);
+        if (mincore((void*) (base + (c << CHUNK_BITS)), bytes, inCore.data()) != 0) {
+            return 0;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < pages; i++) {
+            n += inCore[i] & 1;
+        }
+        return n * page;
+    }
+
+    static long MajorFaults() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_majflt;
+    }
+};
+
+#endif
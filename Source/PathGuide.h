@@ -0,0 +1,368 @@
+#ifndef __H_PATHGUIDE_H__
+#define __H_PATHGUIDE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+/* Learns from which directions bounce light arrives at each place in the
+scene, so that bounce rays can be sent there (Müller et al. 2017, "Practical
+Path Guiding"). Space is divided by a binary tree, halving cells along x, y
+and z in turn; each leaf has a quadtree over the sphere of directions, whose
+nodes are split where much light comes from.
+
+Training goes in iterations. During one, the workers record the light their
+bounce rays found into the recording quadtrees. Refine() then makes what was
+recorded the distribution to sample from, splits leaves that saw many rays,
+and lays out new recording quadtrees after the light just learned. Recording
+is lock free; Refine() and Reset() must only be called between passes.
+
+Directions are mapped to the unit square by (cos theta, phi), which keeps
+areas, so a density on the square is one on the sphere times 4 pi. */
+class PathGuide {
+public:
+    // Deepest quadtree level, and the share of the light above which a
+    // quadtree node is split
+    static const int MAX_DEPTH = 10;
+    static constexpr float SPLIT_ENERGY = 0.01f;
+
+    // Rays a spatial leaf has to see in the first iteration before it is
+    // split; grows with the square root of the iteration's length
+    static const int SPLIT_RAYS = 12000;
+
+    // Share of bounce rays sent where the guide says, the rest going where
+    // the surface does
+    static constexpr float SAMPLE_SHARE = 0.5f;
+
+    /* Off until Reset() */
+    PathGuide()
+    : lo(-1, -1, -1), hi(1, 1, 1), nodes(1), leaves(1),
+      ready(false), recording(false), passes(0), iteration(0) {}
+
+    /* Forgets everything learned and starts recording again, for a scene
+    within the box [lo, hi] */
+    void Reset(const vec3& lo, const vec3& hi) {
+        this->lo = lo;
+        this->hi = hi;
+        nodes.assign(1, SpatialNode());
+        leaves.assign(1, Leaf());
+        ready = false;
+        recording = true;
+        passes = 0;
+        iteration = 0;
+    }
+
+    /* Counts a finished pass. Iteration k lasts 2^k passes, and the one
+    that reaches trainingPasses in total is the last. Returns true if the
+    pass ended an iteration. */
+    bool EndPass(int trainingPasses) {
+        if (!recording) {
+            return false;
+        }
+        passes++;
+        if (passes < (1 << (iteration + 1)) - 1) {
+            return false;
+        }
+        Refine(iteration, passes >= trainingPasses);
+        iteration++;
+        return true;
+    }
+
+    /* Number of regions space is divided into */
+    int Regions() const {
+        return leaves.size();
+    }
+
+    /* True once there is a distribution to sample */
+    bool Ready() const {
+        return ready;
+    }
+
+    bool Recording() const {
+        return recording;
+    }
+
+    /* Direction from the distribution at `position`, for two numbers in
+    [0, 1) */
+    vec3 Sample(const vec3& position, float u, float v) const {
+        const Quadtree& tree = leaves[Find(position)].sampling;
+        vec2 p(u, v);
+        float size = 1;
+        vec2 corner(0, 0);
+        for (int n = 0; tree.child[n] != 0; ) {
+            // Pick a quadrant in proportion to its light, then reuse the
+            // number within it
+            int first = tree.child[n];
+            float e[4];
+            for (int c = 0; c < 4; c++) {
+                e[c] = tree.energy[first + c];
+            }
+            float left = e[0] + e[2], total = left + e[1] + e[3];
+            if (total <= 0) {
+                break;
+            }
+
+            int cx, cy;
+            float split = left / total;
+            if (p.x < split) {
+                cx = 0;
+                p.x /= split;
+            } else {
+                cx = 1;
+                p.x = (p.x - split) / (1 - split);
+            }
+            float column = e[cx] + e[cx + 2];
+            float splitY = column > 0 ? e[cx] / column : 0.5f;
+            if (p.y < splitY) {
+                cy = 0;
+                p.y /= splitY;
+            } else {
+                cy = 1;
+                p.y = (p.y - splitY) / (1 - splitY);
+            }
+            p = glm::min(p, vec2(0.99999f, 0.99999f));
+
+            size /= 2;
+            corner += size * vec2(cx, cy);
+            n = first + cx + 2 * cy;
+        }
+        return Direction(corner + size * p);
+    }
+
+    /* Density of Sample() at `position` towards the unit vector
+    `direction`, per solid angle */
+    float Pdf(const vec3& position, const vec3& direction) const {
+        return SquarePdf(leaves[Find(position)].sampling, Square(direction)) / (4 * M_PI);
+    }
+
+    /* Records that a ray from `position` in the unit vector `direction`
+    brought back light of the given strength: what it contributes, over the
+    density it was sent with */
+    void Record(const vec3& position, const vec3& direction, float light) {
+        Leaf& leaf = leaves[Find(position)];
+        leaf.rays.fetch_add(1, memory_order_relaxed);
+        if (light <= 0 || !(light < numeric_limits<float>::max())) {
+            return;
+        }
+
+        const Quadtree& tree = leaf.recording;
+        vec2 p = Square(direction);
+        int n = 0;
+        while (tree.child[n] != 0) {
+            int cx = p.x >= 0.5f, cy = p.y >= 0.5f;
+            p = 2.f * p - vec2(cx, cy);
+            n = tree.child[n] + cx + 2 * cy;
+        }
+        leaf.recorded[n].Add(light);
+    }
+
+private:
+    /* Ends a training iteration: samples from what was recorded from now on,
+    splits busy leaves and lays out new recording trees. With `last`, stops
+    recording. */
+    void Refine(int iteration, bool last) {
+        for (size_t i = 0; i < leaves.size(); i++) {
+            Leaf& leaf = leaves[i];
+            leaf.sampling = leaf.recording;
+            for (size_t n = 0; n < leaf.sampling.energy.size(); n++) {
+                leaf.sampling.energy[n] = leaf.recorded[n].Get();
+            }
+            Sum(leaf.sampling, 0);
+        }
+        ready = true;
+        recording = !last;
+        if (last) {
+            return;
+        }
+
+        // Split leaves that saw enough rays, and the halves again while
+        // each would have seen enough; both start out with the parent's
+        // distribution
+        float threshold = SPLIT_RAYS * sqrt((float) (1 << iteration));
+        for (size_t n = 0; n < nodes.size(); n++) {
+            if (nodes[n].child != 0 || leaves[nodes[n].leaf].rays.load() < threshold ||
+                nodes[n].depth >= 3 * 20) {
+                continue;
+            }
+            int first = nodes.size();
+            for (int c = 0; c < 2; c++) {
+                SpatialNode child;
+                child.depth = nodes[n].depth + 1;
+                child.leaf = c == 0 ? nodes[n].leaf : (int) leaves.size();
+                nodes.push_back(child);
+            }
+            Leaf& parent = leaves[nodes[n].leaf];
+            parent.rays.store(parent.rays.load() / 2);
+            Leaf copy = parent;
+            leaves.push_back(copy);
+            nodes[n].child = first;
+        }
+
+        for (size_t i = 0; i < leaves.size(); i++) {
+            Leaf& leaf = leaves[i];
+            Quadtree layout;
+            float total = leaf.sampling.energy[0];
+            Layout(leaf.sampling, 0, total > 0 ? 1.f : 0.f, total, layout, 0, 0);
+            layout.energy.assign(layout.child.size(), 0);
+            leaf.recording = layout;
+            leaf.recorded.assign(layout.child.size(), AtomicFloat());
+            leaf.rays.store(0);
+        }
+    }
+
+    /* Float that workers can add to at the same time */
+    struct AtomicFloat {
+        atomic<float> value;
+
+        AtomicFloat() : value(0) {}
+        AtomicFloat(const AtomicFloat& other) : value(other.Get()) {}
+
+        AtomicFloat& operator=(const AtomicFloat& other) {
+            value.store(other.Get(), memory_order_relaxed);
+            return *this;
+        }
+
+        void Add(float x) {
+            float old = value.load(memory_order_relaxed);
+            while (!value.compare_exchange_weak(old, old + x, memory_order_relaxed)) {
+            }
+        }
+
+        float Get() const {
+            return value.load(memory_order_relaxed);
+        }
+    };
+
+    /* Node n's children are nodes child[n] to child[n] + 3, for the
+    quadrants (0, 0), (1, 0), (0, 1) and (1, 1); 0 for a leaf */
+    struct Quadtree {
+        vector<int> child;
+        vector<float> energy;
+
+        Quadtree() : child(1, 0), energy(1, 0) {}
+    };
+
+    struct Leaf {
+        Quadtree sampling, recording;
+        vector<AtomicFloat> recorded;   // per node of `recording`
+        atomic<int> rays;
+
+        Leaf() : recorded(1), rays(0) {}
+        Leaf(const Leaf& other)
+        : sampling(other.sampling), recording(other.recording),
+          recorded(other.recorded), rays(other.rays.load()) {}
+
+        Leaf& operator=(const Leaf& other) {
+            sampling = other.sampling;
+            recording = other.recording;
+            recorded = other.recorded;
+            rays.store(other.rays.load());
+            return *this;
+        }
+    };
+
+    /* Splits along axis depth % 3 at the middle of its cell */
+    struct SpatialNode {
+        int child;      // first of two, or 0 for a leaf
+        int leaf;
+        int depth;
+
+        SpatialNode() : child(0), leaf(0), depth(0) {}
+    };
+
+    vec3 lo, hi;
+    vector<SpatialNode> nodes;
+    vector<Leaf> leaves;
+    bool ready, recording;
+    int passes, iteration;
+
+    int Find(const vec3& position) const {
+        vec3 min = lo, max = hi;
+        int n = 0;
+        while (nodes[n].child != 0) {
+            int axis = nodes[n].depth % 3;
+            float middle = (min[axis] + max[axis]) / 2;
+            if (position[axis] < middle) {
+                max[axis] = middle;
+                n = nodes[n].child;
+            } else {
+                min[axis] = middle;
+                n = nodes[n].child + 1;
+            }
+        }
+        return nodes[n].leaf;
+    }
+
+    static vec2 Square(const vec3& d) {
+        float phi = atan2(d.y, d.x);
+        if (phi < 0) {
+            phi += 2 * M_PI;
+        }
+        return glm::clamp(
+            vec2((d.z + 1) / 2, phi / (2 * M_PI)), vec2(0, 0), vec2(0.99999f, 0.99999f)
+        );
+    }
+
+    static vec3 Direction(const vec2& p) {
+        float z = 2 * p.x - 1;
+        float r = sqrt(std::max(0.f, 1 - z * z));
+        float phi = 2 * M_PI * p.y;
+        return vec3(r * cos(phi), r * sin(phi), z);
+    }
+
+    static float SquarePdf(const Quadtree& tree, vec2 p) {
+        float pdf = 1;
+        int n = 0;
+        while (tree.child[n] != 0 && tree.energy[n] > 0) {
+            int cx = p.x >= 0.5f, cy = p.y >= 0.5f;
+            p = 2.f * p - vec2(cx, cy);
+            int next = tree.child[n] + cx + 2 * cy;
+            pdf *= 4 * tree.energy[next] / tree.energy[n];
+            n = next;
+        }
+        return pdf;
+    }
+
+    /* Fills in the energy of inner nodes from their leaves */
+    static float Sum(Quadtree& tree, int n) {
+        if (tree.child[n] != 0) {
+            tree.energy[n] = 0;
+            for (int c = 0; c < 4; c++) {
+                tree.energy[n] += Sum(tree, tree.child[n] + c);
+            }
+        }
+        return tree.energy[n];
+    }
+
+    /* Lays out node `out` of a new recording tree, covering what node n of
+    `from` covers, or the share `fraction` of it when n is a leaf above it.
+    Nodes with more than SPLIT_ENERGY of the light are split. */
+    static void Layout(
+        const Quadtree& from, int n, float fraction, float total,
+        Quadtree& out, int outNode, int depth
+    ) {
+        float share = total > 0 ? fraction * from.energy[n] / total : 0;
+        if (depth >= MAX_DEPTH || (share <= SPLIT_ENERGY && depth > 0)) {
+            return;
+        }
+
+        int first = out.child.size();
+        out.child[outNode] = first;
+        out.child.resize(first + 4, 0);
+        for (int c = 0; c < 4; c++) {
+            if (from.child[n] != 0) {
+                Layout(from, from.child[n] + c, 1, total, out, first + c, depth + 1);
+            } else {
+                Layout(from, n, fraction / 4, total, out, first + c, depth + 1);
+            }
+        }
+    }
+};
+
+#endif
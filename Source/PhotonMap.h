@@ -0,0 +1,116 @@
+#ifndef __H_PHOTONMAP_H__
+#define __H_PHOTONMAP_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+/* Light carried to a diffuse surface by one photon */
+struct Photon {
+    vec3 position;
+    vec3 normal;    // of the surface it landed on
+    vec3 power;
+};
+
+/* Photons in a hash grid of cells as wide as the gather radius, so a lookup
+reads the 27 cells around the query point. The photons are sorted by cell
+and each table slot holds the range of its cell; cells that hash to the same
+slot share it, and the distance test sorts them out. Neighbouring cells may
+share a slot too, so a lookup reads each slot only once. */
+class PhotonMap {
+public:
+    PhotonMap() : radius(1) {}
+
+    /* Takes the photons and sorts them into the grid */
+    void Build(vector<Photon>& landed, float gatherRadius) {
+        radius = gatherRadius;
+        int n = landed.size();
+        int slots = 1;
+        while (slots < n) {
+            slots <<= 1;
+        }
+
+        // Counting sort by slot
+        start.assign(slots + 1, 0);
+        vector<int> slot(n);
+        for (int i = 0; i < n; i++) {
+            slot[i] = Slot(Cell(landed[i].position));
+            start[slot[i] + 1]++;
+        }
+        for (int s = 0; s < slots; s++) {
+            start[s + 1] += start[s];
+        }
+        photons.resize(n);
+        vector<int> next(start.begin(), start.end() - 1);
+        for (int i = 0; i < n; i++) {
+            photons[next[slot[i]]++] = landed[i];
+        }
+        landed.clear();
+    }
+
+    bool Empty() const {
+        return photons.empty();
+    }
+
+    size_t Size() const {
+        return photons.size();
+    }
+
+    /* Power of the photons within the gather radius that landed on surfaces
+    facing the same way, per area of the gather disc */
+    vec3 Estimate(const vec3& position, const vec3& normal) const {
+        vec3 power(0, 0, 0);
+        if (photons.empty()) {
+            return power;
+        }
+
+        ivec3 cell = Cell(position);
+        int slots[27];
+        int n = 0;
+        for (int z = -1; z <= 1; z++) {
+            for (int y = -1; y <= 1; y++) {
+                for (int x = -1; x <= 1; x++) {
+                    slots[n++] = Slot(cell + ivec3(x, y, z));
+                }
+            }
+        }
+        sort(slots, slots + n);
+        n = unique(slots, slots + n) - slots;
+
+        float radius2 = radius * radius;
+        for (int k = 0; k < n; k++) {
+            int s = slots[k];
+            for (int i = start[s]; i < start[s + 1]; i++) {
+                const Photon& p = photons[i];
+                vec3 d = p.position - position;
+                if (dot(d, d) < radius2 && dot(p.normal, normal) > 0.9f) {
+                    power += p.power;
+                }
+            }
+        }
+        return power / (float) (M_PI * radius2);
+    }
+
+private:
+    float radius;
+    vector<Photon> photons;
+    vector<int> start;      // slot s holds photons [start[s], start[s + 1])
+
+    ivec3 Cell(const vec3& position) const {
+        return ivec3(glm::floor(position / radius));
+    }
+
+    int Slot(const ivec3& cell) const {
+        uint32_t h = (uint32_t) cell.x * 73856093u ^
+                     (uint32_t) cell.y * 19349663u ^
+                     (uint32_t) cell.z * 83492791u;
+        return h & (start.size() - 2);
+    }
+};
+
+#endif
@@ -14,7 +14,8 @@ public:
     // Inverse of depth of the point corresponding to pixel
     float invZ;
 
-    // The triangle of the belonging point
+    // The triangle of the belonging point, only valid while that triangle is
+    // being shaded
     Triangle* triangle;
 
     // UV space coordinates for the triangle
@@ -39,19 +39,19 @@ public:
         );
     }
 
-    /* Shade vector of triangles */
+    /* Shade every face of a mesh */
     static void Shade(
-        vector<Triangle>& triangles,
+        const Mesh& mesh,
         Pixel (&buffer)[SCREEN_HEIGHT][SCREEN_WIDTH],
         Camera& cam,
         PointLight light
     ) {
-        int numTri = triangles.size();
+        int numTri = mesh.faces.size();
         for (int i = 0; i < numTri; i++) {
             // Shade(triangles[i], buffer, cam, light);
             SDL_SemWait(empty);
 
-            queue[tail] = &triangles[i];
+            queue[tail] = i;
     		tail = (tail + 1) % 100;
 
             SDL_SemPost(full);
@@ -14,7 +14,7 @@ class PointLight {
 public:
     vec3 position;
     vec3 color;
-    vector<Primitive*>* primitives;
+    Scene* scene;
 
     PointLight(vec3 position, vec3 color)
     : position(position), color(color) {
@@ -27,10 +27,11 @@ public:
         indirectLight = vec3(0.5, 0.5, 0.5);
 
         // Texture mapping
-        if (point.triangle->material.texture) {
+        const Material& material = MaterialTable::Get(point.triangle->materialId);
+        if (material.texture) {
             // Render using texture
 
-            if (point.triangle->material.textureImage == NULL) {
+            if (material.textureImage == NULL) {
                 vec3 purple (.75f, 0, .75f);
                 vec3 black (0, 0, 0);
                 bool u = (int) (point.u * 10) % 2;
@@ -38,13 +39,13 @@ public:
                 v = !v;
                 point.diffuse = u != v ? purple : black;
             } else {
-                int x = point.triangle->material.textureImage->w * point.u;
-                int y = point.triangle->material.textureImage->h * point.v;
-                point.diffuse = GetPixelSDL(point.triangle->material.textureImage, x, y);
+                int x = material.textureImage->w * point.u;
+                int y = material.textureImage->h * point.v;
+                point.diffuse = GetPixelSDL(material.textureImage, x, y);
             }
         } else {
             // Use triangle diffuse color
-            point.diffuse = point.triangle->material.diffuse;
+            point.diffuse = material.diffuse;
         }
 
         color = (point.luminance + indirectLight) * point.diffuse;
@@ -67,7 +68,7 @@ public:
             );
 
             found = Intersection::ClosestIntersection(
-                shadowRay, *primitives, lightIntersect, -1
+                shadowRay, *scene, lightIntersect, -1
             );
         }
 
@@ -7,11 +7,16 @@ class Primitive {
 public:
     bool isTriangle;
     bool isSphere;
-    Material material;
+    bool isMesh;
+    bool isInstance;
+    MaterialId materialId;
 
     Primitive() {
         isTriangle = false;
         isSphere = false;
+        isMesh = false;
+        isInstance = false;
+        materialId = 0;
     }
 };
 
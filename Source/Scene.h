@@ -0,0 +1,155 @@
+#ifndef __H_SCENE_H__
+#define __H_SCENE_H__
+
+#include <atomic>
+#include <thread>
+#include <glm/glm.hpp>
+#include <vector>
+#include "BVH.h"
+#include "Mesh.h"
+#include "MeshInstance.h"
+#include "Primitive.h"
+#include "Sphere.h"
+#include "Triangle.h"
+
+using namespace std;
+using namespace glm;
+
+/* Everything a ray can hit. Meshes carry their own (bottom-level) BVH over
+their faces; the scene adds a top-level BVH over the primitives, most of
+which are expected to be instances of a few meshes.
+
+When primitives move, Update() refits the top-level BVH rather than building
+it again. Refitting keeps the tree's structure, which gets worse the further
+things move; once its cost has grown by REBUILD_RATIO a new tree is built on
+a background thread and swapped in by a later Update(). */
+class Scene {
+public:
+    static constexpr float REBUILD_RATIO = 1.5f;
+
+    vector<Primitive*> primitives;
+
+    // Hierarchy over the primitives, empty until Build() is called
+    BVH bvh;
+
+    Scene() : builtCost(0), rebuilding(false), rebuilt(false), nextBuilt(false) {}
+
+    ~Scene() {
+        if (rebuilding) {
+            rebuilder.join();
+        }
+    }
+
+    void Add(Primitive* primitive) {
+        primitives.push_back(primitive);
+    }
+
+    /* Builds the top-level BVH. This reorders the primitives, so indices
+    taken before the call are no longer valid. Meshes should have built
+    their own BVH first. With more primitives than a BVH can hold, the
+    tree stays empty and rays test every primitive. */
+    void Build() {
+        vector<vec3> lo, hi;
+        PrimitiveBounds(lo, hi);
+
+        vector<int> order;
+        if (bvh.Build(lo, hi, order)) {
+            Reorder(order);
+        }
+        builtCost = bvh.Cost();
+    }
+
+    /* Brings the top-level BVH up to date after primitives moved. Meshes
+    are rigid: only whole primitives move, such as instances placed with
+    MeshInstance::Place(), and the meshes' own BVHs are left as they are.
+    Must not run while rays are being traced, and primitives must not be
+    added between Build() and here. Returns true if a rebuilt tree was
+    swapped in, which reorders the primitives like Build() does. */
+    bool Update() {
+        vector<vec3> lo, hi;
+        bool swapped = false;
+
+        if (rebuilding && rebuilt.load(memory_order_acquire)) {
+            rebuilder.join();
+            rebuilding = false;
+            rebuilt.store(false, memory_order_relaxed);
+
+            // The new tree was built from the bounds at the time it was
+            // started; things have moved since, so refit it right away. If
+            // the build failed, the old tree stays and is only rebuilt once
+            // it has got worse again.
+            if (nextBuilt) {
+                bvh.nodes = next.nodes;
+                builtCost = nextCost;
+                Reorder(nextOrder);
+                swapped = true;
+            } else {
+                builtCost = bvh.Cost();
+            }
+        }
+
+        PrimitiveBounds(lo, hi);
+        bvh.Refit(lo, hi);
+
+        if (!rebuilding && bvh.Cost() > REBUILD_RATIO * builtCost) {
+            rebuilding = true;
+            rebuilder = thread([this](vector<vec3> lo, vector<vec3> hi) {
+                nextBuilt = next.Build(lo, hi, nextOrder);
+                nextCost = next.Cost();
+                rebuilt.store(true, memory_order_release);
+            }, lo, hi);
+        }
+        return swapped;
+    }
+
+    static void Bounds(const Primitive* p, vec3& lo, vec3& hi) {
+        if (p->isMesh) {
+            ((const Mesh*) p)->Bounds(lo, hi);
+        } else if (p->isInstance) {
+            ((const MeshInstance*) p)->Bounds(lo, hi);
+        } else if (p->isSphere) {
+            const Sphere* s = (const Sphere*) p;
+            lo = s->position - vec3(s->radius);
+            hi = s->position + vec3(s->radius);
+        } else if (p->isTriangle) {
+            const Triangle* t = (const Triangle*) p;
+            lo = glm::min(t->v0, glm::min(t->v1, t->v2));
+            hi = glm::max(t->v0, glm::max(t->v1, t->v2));
+        }
+    }
+
+private:
+    // Cost of the current tree when it was built
+    float builtCost;
+
+    // Background rebuild. `next`, `nextOrder`, `nextBuilt` and `nextCost`
+    // belong to the rebuilder until `rebuilt` is set.
+    thread rebuilder;
+    bool rebuilding;
+    atomic<bool> rebuilt;
+    BVH next;
+    vector<int> nextOrder;
+    bool nextBuilt;
+    float nextCost;
+
+    void PrimitiveBounds(vector<vec3>& lo, vector<vec3>& hi) const {
+        int n = primitives.size();
+        lo.resize(n);
+        hi.resize(n);
+        for (int i = 0; i < n; i++) {
+            Bounds(primitives[i], lo[i], hi[i]);
+        }
+    }
+
+    /* Puts the primitives in a BVH's leaf order */
+    void Reorder(const vector<int>& order) {
+        int n = primitives.size();
+        vector<Primitive*> sorted(n);
+        for (int i = 0; i < n; i++) {
+            sorted[i] = primitives[order[i]];
+        }
+        primitives.swap(sorted);
+    }
+};
+
+#endif
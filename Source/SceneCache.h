@@ -0,0 +1,255 @@
+#ifndef __H_SCENECACHE_H__
+#define __H_SCENECACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "MappedFile.h"
+#include "Mesh.h"
+
+using namespace std;
+
+/* Binary snapshot of an imported mesh: its buffers, the BVH built over it
+and the material table it refers to. The buffers are stored exactly as they
+are laid out in memory, so loading maps the file and points the mesh at it;
+nothing is parsed, copied or rebuilt.
+
+The cache is keyed on the size and modification time of the source file and
+is only valid for the build that wrote it (same version and struct sizes).
+Anything else makes Load() fail and the caller imports the source again. */
+class SceneCache {
+public:
+    static const uint32_t VERSION = 3;
+
+    /* Maps `filename` into `mesh` if it is a valid cache of `source`. The
+    mesh views the mapping, so the SceneCache must outlive it. */
+    bool Load(const char* filename, const char* source, Mesh& mesh) {
+        Header key;
+        if (!MakeKey(source, key) || !file.Open(filename) || file.size < sizeof(Header)) {
+            file.Close();
+            return false;
+        }
+
+        const Header& header = *(const Header*) file.data;
+        if (memcmp(&header, &key, offsetof(Header, sections)) != 0 ||
+            !CheckSections(header)) {
+            file.Close();
+            return false;
+        }
+
+        // Every index has to be in range, so that a stale or damaged cache
+        // is imported again rather than read out of bounds. This reads the
+        // faces and nodes once.
+        const Section& m = header.sections[MATERIALS];
+        mesh.Clear();
+        Map(header, VERTICES, mesh.vertices);
+        Map(header, NORMALS, mesh.normals);
+        Map(header, UVS, mesh.uvs);
+        Map(header, FACES, mesh.faces);
+        Map(header, NODES, mesh.bvh.nodes);
+        if (!mesh.Valid(m.count)) {
+            mesh.Clear();
+            file.Close();
+            return false;
+        }
+
+        // Materials that already exist (the ones of the rest of the scene)
+        // must be the same as when the cache was written, since faces refer
+        // to them by id. Any others are added.
+        const MaterialRecord* records = (const MaterialRecord*) (file.data + m.offset);
+        for (size_t i = 0; i < m.count && i < MaterialTable::materials.size(); i++) {
+            MaterialRecord current = MakeRecord(MaterialTable::materials[i]);
+            if (memcmp(&current, &records[i], sizeof(MaterialRecord)) != 0) {
+                mesh.Clear();
+                file.Close();
+                return false;
+            }
+        }
+        for (size_t i = MaterialTable::materials.size(); i < m.count; i++) {
+            MaterialTable::Add(MakeMaterial(records[i]));
+        }
+        return true;
+    }
+
+    bool IsOpen() const {
+        return file.data != NULL;
+    }
+
+    /* The mapping the loaded mesh views */
+    const MappedFile& File() const {
+        return file;
+    }
+
+    /* Writes the mesh (with its BVH) and the current material table. The file
+    is written under a temporary name and renamed, so a reader never sees a
+    half written cache. */
+    static bool Save(const char* filename, const char* source, const Mesh& mesh) {
+        Header header;
+        if (!MakeKey(source, header)) {
+            return false;
+        }
+
+        vector<MaterialRecord> materials;
+        for (size_t i = 0; i < MaterialTable::materials.size(); i++) {
+            materials.push_back(MakeRecord(MaterialTable::materials[i]));
+        }
+
+        const void* data[NUM_SECTIONS] = {
+            mesh.vertices.data(), mesh.normals.data(), mesh.uvs.data(),
+            mesh.faces.data(), mesh.bvh.nodes.data(), materials.data()
+        };
+        size_t offset = sizeof(Header);
+        Describe(header, VERTICES, mesh.vertices.size(), sizeof(vec3), offset);
+        Describe(header, NORMALS, mesh.normals.size(), sizeof(vec3), offset);
+        Describe(header, UVS, mesh.uvs.size(), sizeof(vec2), offset);
+        Describe(header, FACES, mesh.faces.size(), sizeof(MeshFace), offset);
+        Describe(header, NODES, mesh.bvh.nodes.size(), sizeof(BVHStoredNode), offset);
+        Describe(header, MATERIALS, materials.size(), sizeof(MaterialRecord), offset);
+
+        string temporary = string(filename) + ".tmp";
+        FILE* f = fopen(temporary.c_str(), "wb");
+        if (f == NULL) {
+            return false;
+        }
+
+        bool ok = fwrite(&header, sizeof(Header), 1, f) == 1;
+        size_t written = sizeof(Header);
+        static const char zeros[ALIGNMENT] = {};
+        for (int i = 0; i < NUM_SECTIONS && ok; i++) {
+            const Section& s = header.sections[i];
+            size_t bytes = s.count * s.elementSize;
+            ok = fwrite(zeros, 1, s.offset - written, f) == s.offset - written &&
+                 (bytes == 0 || fwrite(data[i], 1, bytes, f) == bytes);
+            written = s.offset + bytes;
+        }
+
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), filename) != 0) {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    enum { VERTICES, NORMALS, UVS, FACES, NODES, MATERIALS, NUM_SECTIONS };
+
+    // Sections start on cache line boundaries
+    static const size_t ALIGNMENT = 64;
+
+    struct Section {
+        uint64_t offset;
+        uint64_t count;
+        uint64_t elementSize;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t faceSize;
+        uint32_t nodeSize;
+        uint32_t materialSize;
+        uint32_t padding;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        Section sections[NUM_SECTIONS];
+    };
+
+    /* Material without the texture pointers, which the raytracer does not
+    use. Zero-filled before use so records can be compared bytewise. */
+    struct MaterialRecord {
+        float diffuse[3];
+        float reflectStrength;
+        float reflectRoughness;
+        float ior;
+        float refractRoughness;
+        uint8_t isReflective;
+        uint8_t isRefractive;
+        uint8_t padding[2];
+    };
+
+    MappedFile file;
+
+    static bool MakeKey(const char* source, Header& header) {
+        struct stat st;
+        if (stat(source, &st) != 0) {
+            return false;
+        }
+
+        memset(&header, 0, sizeof(Header));
+        memcpy(header.magic, "RTSCENE", 8);
+        header.version = VERSION;
+        header.headerSize = sizeof(Header);
+        header.faceSize = sizeof(MeshFace);
+        header.nodeSize = sizeof(BVHStoredNode);
+        header.materialSize = sizeof(MaterialRecord);
+        header.sourceSize = st.st_size;
+        header.sourceTime = st.st_mtime;
+        return true;
+    }
+
+    static void Describe(Header& header, int i, size_t count, size_t elementSize, size_t& offset) {
+        offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        header.sections[i].offset = offset;
+        header.sections[i].count = count;
+        header.sections[i].elementSize = elementSize;
+        offset += count * elementSize;
+    }
+
+    /* Every section has to lie inside the file and be aligned */
+    bool CheckSections(const Header& header) const {
+        static const size_t sizes[NUM_SECTIONS] = {
+            sizeof(vec3), sizeof(vec3), sizeof(vec2),
+            sizeof(MeshFace), sizeof(BVHStoredNode), sizeof(MaterialRecord)
+        };
+        for (int i = 0; i < NUM_SECTIONS; i++) {
+            const Section& s = header.sections[i];
+            if (s.elementSize != sizes[i] || s.offset % ALIGNMENT != 0 ||
+                s.offset > file.size || s.count > (file.size - s.offset) / s.elementSize) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename T>
+    void Map(const Header& header, int i, Buffer<T>& buffer) {
+        const Section& s = header.sections[i];
+        buffer.Map((const T*) (file.data + s.offset), s.count);
+    }
+
+    static MaterialRecord MakeRecord(const Material& material) {
+        MaterialRecord r;
+        memset(&r, 0, sizeof(MaterialRecord));
+        r.diffuse[0] = material.diffuse.x;
+        r.diffuse[1] = material.diffuse.y;
+        r.diffuse[2] = material.diffuse.z;
+        r.reflectStrength = material.reflectStrength;
+        r.reflectRoughness = material.reflectRoughness;
+        r.ior = material.ior;
+        r.refractRoughness = material.refractRoughness;
+        r.isReflective = material.isReflective;
+        r.isRefractive = material.isRefractive;
+        return r;
+    }
+
+    static Material MakeMaterial(const MaterialRecord& r) {
+        Material material;
+        material.diffuse = vec3(r.diffuse[0], r.diffuse[1], r.diffuse[2]);
+        material.reflectStrength = r.reflectStrength;
+        material.reflectRoughness = r.reflectRoughness;
+        material.ior = r.ior;
+        material.refractRoughness = r.refractRoughness;
+        material.isReflective = r.isReflective;
+        material.isRefractive = r.isRefractive;
+        return material;
+    }
+};
+
+#endif
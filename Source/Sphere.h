@@ -8,10 +8,10 @@ public:
     vec3 position;
     float radius;
 
-    Sphere (vec3 position, float radius, vec3 color)
+    Sphere (vec3 position, float radius, MaterialId material)
     : position(position), radius(radius) {
         this->isSphere = true;
-        this->material.diffuse = color;
+        this->materialId = material;
     }
 };
 
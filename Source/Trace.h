@@ -0,0 +1,114 @@
+#ifndef __H_TRACE_H__
+#define __H_TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+/* Timeline recorder that writes Chrome trace JSON (chrome://tracing or
+Perfetto). Every thread owns one fixed-size ring of events and is the only
+writer of that ring, so recording is a couple of stores and needs no locks.
+When a ring wraps, the oldest events are overwritten. A recorder created
+with capacity 0 allocates no rings and records nothing. */
+class TraceRecorder {
+public:
+    struct Event {
+        const char* name;
+        int64_t begin;
+        int64_t end;
+        int arg;
+    };
+
+    TraceRecorder(int numThreads, int capacity)
+    : capacity(capacity), rings(capacity > 0 ? numThreads : 0) {
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < rings.size(); i++) {
+            rings[i].events.resize(capacity);
+            rings[i].head = 0;
+        }
+    }
+
+    /* Microseconds since the recorder was created */
+    int64_t Now() const {
+        return chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start
+        ).count();
+    }
+
+    /* Record an event that began at `begin` and ends now. Must only be called
+    by the thread that owns ring `thread`. */
+    void Record(int thread, const char* name, int64_t begin, int arg) {
+        if (capacity == 0) {
+            return;
+        }
+        Ring& ring = rings[thread];
+        uint64_t head = ring.head.load(memory_order_relaxed);
+
+        Event& e = ring.events[head % capacity];
+        e.name = name;
+        e.begin = begin;
+        e.end = Now();
+        e.arg = arg;
+
+        ring.head.store(head + 1, memory_order_release);
+    }
+
+    /* Write all recorded events as complete ("X") events, one track per
+    thread. Call after the recording threads have been joined. */
+    void Save(const char* filename, int numWorkers) const {
+        ofstream out(filename);
+        out << "{\"traceEvents\":[\n";
+
+        bool first = true;
+        for (size_t t = 0; t < rings.size(); t++) {
+            const Ring& ring = rings[t];
+            uint64_t head = ring.head.load(memory_order_acquire);
+            uint64_t begin = head > (uint64_t) capacity ? head - capacity : 0;
+
+            // Name the track so workers and the display thread are labelled
+            out << (first ? "" : ",\n");
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                << ",\"args\":{\"name\":\"";
+            if ((int) t < numWorkers) {
+                out << "Worker " << t;
+            } else {
+                out << "Display";
+            }
+            out << "\"}}";
+            first = false;
+
+            for (uint64_t i = begin; i < head; i++) {
+                const Event& e = ring.events[i % capacity];
+                out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1"
+                    << ",\"tid\":" << t
+                    << ",\"ts\":" << e.begin
+                    << ",\"dur\":" << e.end - e.begin
+                    << ",\"args\":{\"n\":" << e.arg << "}}";
+            }
+        }
+
+        out << "\n]}\n";
+    }
+
+private:
+    struct Ring {
+        atomic<uint64_t> head;
+        vector<Event> events;
+
+        // Keep neighbouring rings' heads off the same cache line
+        char padding[64];
+
+        Ring() : head(0) {}
+        Ring(const Ring& r) : head(r.head.load()), events(r.events) {}
+    };
+
+    int capacity;
+    vector<Ring> rings;
+    chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -8,14 +8,18 @@ public:
 	vec3 v0, v1, v2;
 	vec3 normal;
 
+	// Whether the back face is visible, i.e. the material is refractive
+	bool twoSided;
+
 	// UV coordinates
 	vec2 uv0, uv1, uv2;
 
-	Triangle(vec3 v0, vec3 v1, vec3 v2, vec3 color )
+	Triangle(vec3 v0, vec3 v1, vec3 v2, MaterialId material )
 		: v0(v0), v1(v1), v2(v2)
 	{
         this->isTriangle = true;
-		this->material.diffuse = color;
+		this->materialId = material;
+		this->twoSided = MaterialTable::Get(material).isRefractive;
 		ComputeNormal();
 	}
 
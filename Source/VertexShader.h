@@ -26,8 +26,10 @@ public:
         verts[0] = triangle.v0;
         verts[1] = triangle.v1;
         verts[2] = triangle.v2;
+        const Material& material = MaterialTable::Get(triangle.materialId);
+        bool hasUVs = material.texture || material.normalMap;
         vec2 uvs[3];
-        if (triangle.material.texture || triangle.material.normalMap) {
+        if (hasUVs) {
             uvs[0] = triangle.uv0;
             uvs[1] = triangle.uv1;
             uvs[2] = triangle.uv2;
@@ -43,7 +45,7 @@ public:
             pixels[i].invZ = 1.0 / cam.WorldToCamera(verts[i]).z;
             pixels[i].pos3d = verts[i];
             pixels[i].triangle = &triangle;
-            if (triangle.material.texture || triangle.material.normalMap) {
+            if (hasUVs) {
                 pixels[i].u = uvs[i][0];
                 pixels[i].v = uvs[i][1];
             }
@@ -35,8 +35,9 @@ Pixel buffer[SCREEN_HEIGHT][SCREEN_WIDTH];
 /* Pin-hole camera */
 Camera cam(0, 0, -3, SCREEN_HEIGHT);
 
-/* Object triangles */
-vector<Primitive*> primitives;
+/* Object mesh */
+Mesh mesh;
+Scene scene;
 
 /* Light */
 PointLight light(
@@ -58,7 +59,7 @@ SDL_sem* full;
 SDL_sem* empty;
 SDL_mutex* bufferMutex;
 SDL_mutex* workersMutex;
-Triangle* queue[100];
+int queue[100];
 int head = 0, tail = 0;
 bool run = true;
 
@@ -81,17 +82,14 @@ int main( int argc, char* argv[] )
 	t = SDL_GetTicks();	// Set start value for timer.
 
 	// Load model
-	vector<Triangle> triangles;
-	LoadTestModel(triangles);
-	for (unsigned int i = 0; i < triangles.size(); i++) {
-		primitives.push_back(&triangles[i]);
-	}
+	LoadTestModel(mesh);
+	scene.Add(&mesh);
 
 	t2 = SDL_GetTicks();
 	dt = float(t2-t);
 	cout << "Loaded model in: " << dt << " ms.\n";
 
-	light.primitives = &primitives;
+	light.scene = &scene;
 
 	// Create mutex and semaphores
 	bufferMutex = SDL_CreateMutex();
@@ -111,7 +109,7 @@ int main( int argc, char* argv[] )
 	{
 		Update();
 		ClearBuffer();
-		PixelShader::Shade(triangles, buffer, cam, light);
+		PixelShader::Shade(mesh, buffer, cam, light);
 		PostProcess::Process(buffer);
 		Draw();
 	}
@@ -138,11 +136,10 @@ int main( int argc, char* argv[] )
 	SDL_DestroySemaphore(threadFinish);
 
 	// Free textures
-	for (size_t i = 0; i < triangles.size(); i++) {
-		if (triangles[i].material.textureImage != NULL) {
-			SDL_FreeSurface(triangles[i].material.textureImage);
-			SDL_FreeSurface(triangles[i].material.normalMapImage);
-			break;
+	for (size_t i = 0; i < MaterialTable::materials.size(); i++) {
+		if (MaterialTable::materials[i].textureImage != NULL) {
+			SDL_FreeSurface(MaterialTable::materials[i].textureImage);
+			SDL_FreeSurface(MaterialTable::materials[i].normalMapImage);
 		}
 	}
 
@@ -156,19 +153,21 @@ int main( int argc, char* argv[] )
 }
 
 int worker(void * data) {
-	Triangle* triangle;
+	int face;
 
 	while (run) {
 		SDL_SemWait(full);
 		SDL_mutexP(workersMutex);
 
-		triangle = queue[head];
+		face = queue[head];
 		head = (head + 1) % 100;
 
 		SDL_mutexV(workersMutex);
 		SDL_SemPost(empty);
 
-		PixelShader::Shade(*triangle, buffer, cam, light);
+		// Expand the face into a triangle for the shaders
+		Triangle triangle = mesh.GetTriangle(face);
+		PixelShader::Shade(triangle, buffer, cam, light);
 
 		SDL_SemPost(threadFinish);
 	}
@@ -7,6 +7,7 @@
 #include <chrono>
 #include <atomic>
 #include <algorithm>
+#include <sstream>
 
 using namespace std;
 using namespace glm;
@@ -18,12 +19,26 @@ using namespace glm;
 #include "TestModel.h"
 #include "Primitive.h"
 #include "Triangle.h"
+#include "Mesh.h"
+#include "MeshLoader.h"
+#include "SceneCache.h"
+#include "Pager.h"
 #include "Sphere.h"
+#include "MeshInstance.h"
+#include "Scene.h"
 #include "Intersection.h"
+#include "PhotonMap.h"
 #include "Light.h"
-#include "Pixel.h"
 #include "Camera.h"
 #include "Ray.h"
+#include "Trace.h"
+#include "Heatmap.h"
+#include "AccumulationBuffer.h"
+#include "AnimationScript.h"
+#include "Checkpoint.h"
+#include "Distributed.h"
+#include "AOV.h"
+#include "Denoiser.h"
 
 /* ----------------------------------------------------------------------------*/
 /* GLOBAL VARIABLES                                                            */
@@ -32,28 +47,123 @@ const int BUCKET_RATIO = 6;
 const int NUM_THREAD = BUCKET_RATIO * BUCKET_RATIO;
 const int SAMPLE = 32;
 const bool INTERACTIVE = false;
+const bool TRACE = false;
+const bool HEATMAP = false;
+
+/* Circles the balls (or the model's copies) around the room, one step per
+pass. Every pass then starts a new image, and the scene's BVH is refitted
+rather than rebuilt. */
+const bool ANIMATE = false;
+
+/* Angular speed of the animation (radians per second) */
+const float ANIMATE_SPEED = 0.5;
+
+/* Small lights along each side of the ceiling, added around the square light
+above the room to try out scenes with many lights. Together they give off as
+much light as that one. */
+const int LIGHT_GRID = 0;
+
+/* Photons traced from the lights before rendering, and again whenever the
+scene moves, for caustics and the light bounced between diffuse surfaces; 0
+to leave those to the bounce rays. Few photons reach the glass and metal, so
+caustics need about a million. A larger gather radius (world units) trades
+noise for blur. */
+const int PHOTONS = 0;
+const float PHOTON_RADIUS = 0.05;
+
+/* Interpolates the bounce light at the camera's hits from sparse records,
+kept across passes and camera moves, instead of tracing it for every sample.
+The result is smooth but stops improving once the records are in place; leave
+it off for reference renders. */
+const bool IRRADIANCE_CACHE = false;
+
+/* Learns where bounce light comes from over the first GUIDE_TRAINING_PASSES
+passes, in iterations that double in length, and sends half the bounce rays
+there from the first iteration's end on. Relearned when a batch frame moves
+objects. Workers of a coordinator do not learn, so they do not guide. */
+const bool PATH_GUIDING = false;
+const int GUIDE_TRAINING_PASSES = 31;
+
+/* Copies of a model given on the command line along each side of the floor */
+const int MODEL_GRID = 1;
+
+/* Most memory (MB) the model's cached geometry may keep resident; 0 for no
+limit. Residency is reported after every frame either way. */
+const int GEOMETRY_CAP_MB = 0;
+
+/* Rays traced at a model's BVH on one thread after loading it, to time the
+node layout chosen with make BVH_COMPRESSED=1; 0 to skip. The rays are the
+same on every run, so the two layouts can be compared. */
+const int BVH_BENCHMARK_RAYS = 0;
+
+/* Seconds between checkpoints of the render's progress, written to
+CHECKPOINT_FILE in the background; 0 to disable. A run started with --resume
+continues from the checkpoint (objects moved by ANIMATE or INTERACTIVE start
+from their initial place again). */
+const int CHECKPOINT_INTERVAL = 60;
+const char* const CHECKPOINT_FILE = "checkpoint.bin";
+
+/* Shows the image through the edge-aware denoiser, refreshed after every
+pass instead of tile by tile. The saved screenshot and frames are denoised
+too. With --listen only the colour guides the filter, as workers do not send
+their first hits back. */
+const bool DENOISE = false;
+
+/* Saves depth, normal, albedo, primitive, face and material of the camera
+rays' first hits next to the screenshot and each frame, as
+screenshot_depth.pfm and so on. They are collected anyway for DENOISE. Not
+available with --listen. */
+const bool AOV = false;
+
+/* Longest the display thread sleeps before checking for input (ms) */
+const int DISPLAY_INTERVAL = 50;
 
 /* Random generator for sampling */
 default_random_engine generator;
 uniform_real_distribution<float> distribution(0, 1);
 
-/* Screen surface and buffer */
+/* Screen surface, accumulated samples, the copy of them being displayed and
+the number of passes of each tile that are on screen */
 SDL_Surface* screen;
-Pixel buffer[SCREEN_HEIGHT][SCREEN_WIDTH];
-int bufferCount[SCREEN_HEIGHT][SCREEN_WIDTH];
-bool pixelGrid[SCREEN_HEIGHT][SCREEN_WIDTH][SAMPLE][SAMPLE];
+AccumulationBuffer accumulation(BUCKET_RATIO, BUCKET_RATIO);
+AccumulationBuffer::Texel snapshot[SCREEN_HEIGHT][SCREEN_WIDTH];
+unsigned drawnVersion[BUCKET_RATIO * BUCKET_RATIO];
+
+/* First hits of the camera rays for AOV and DENOISE, and the filter */
+AOVBuffer aov(SCREEN_WIDTH, SCREEN_HEIGHT);
+Denoiser denoiser(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+/* Strata of the pixel area each tile has sampled in the current image. A
+pass uses one stratum for all pixels of a tile, so this is kept per tile. */
+bool pixelGrid[BUCKET_RATIO * BUCKET_RATIO][SAMPLE][SAMPLE];
+
+/* CPU time spent per pixel (microseconds, summed over passes) for the heatmap */
+float costBuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
 SDL_mutex* mut;
-SDL_sem* sem;
+SDL_cond* passDone;
+/* One semaphore per tile, posted once per pass, so every tile renders
+exactly one pass per round however fast the others are */
+SDL_sem* tileSem[BUCKET_RATIO * BUCKET_RATIO];
 
 /* Pin-hole camera */
 Camera cam(1.75, 0, -4.5, SCREEN_HEIGHT / 0.6);
 
-/* Object triangles and light */
-vector<Primitive*> primitives;
+/* Objects and light */
+Scene scene;
 FlatSquareLight light(
 	vec3(0, -0.98, 0), 15.f * vec3(1.f, 1.f, 0.9f), 0.5
 );
 
+/* Copy of the light for each worker, each with its own random generator */
+vector<FlatSquareLight> workerLight(NUM_THREAD, light);
+
+/* Writes checkpoints in the background */
+Checkpoint checkpoint;
+
+/* Fingerprint of the scene as first set up, the script and the settings; a
+checkpoint is only resumed by a render with the same one */
+uint32_t checkpointScene;
+
 /* Timers */
 int t, t2, dt;
 
@@ -61,87 +171,423 @@ int t, t2, dt;
 atomic_int completedBucket(0);
 atomic_int toExit(0);
 
+/* Timeline of tile passes, semaphore waits and display refreshes, one ring per
+worker plus one for the display thread; saved as trace.json when TRACE is on,
+and without any rings otherwise */
+TraceRecorder trace(NUM_THREAD + 1, TRACE ? 1 << 14 : 0);
+
 /* ----------------------------------------------------------------------------*/
 /* FUNCTIONS                                                                   */
 
-void Update();
+bool Update();
+void Restart();
+void SaveAOV(const string& prefix);
+void SaveCheckpoint(int frame, int passes);
+bool Resume(int frames, size_t& frame, int& passes);
+bool SetFrame(const AnimationScript::Frame& frame, const vector<Primitive*>& movable);
+void EmitPhotons();
+void BenchmarkBVH(const Mesh& mesh);
+void ResetGuide();
+uint32_t SceneFingerprint();
+bool RunWorker(const string& address, const TileHello& hello);
 void Draw();
+void DrawDenoised();
 void DrawBox(int i);
-void DrawBucket(int n, FlatSquareLight light, int sample);
+void DrawBucket(int n, FlatSquareLight& light, int sample);
+void RenderPass(int n, FlatSquareLight& light, int sample, int stratum, vector<vec3>& pass, AOVBuffer* hits);
 
 int main( int argc, char* argv[] )
 {
-	// Initialise buffer counter
+	// Arguments: an optional model, an optional animation script given
+	// with --script that renders a sequence of frames, and --resume to
+	// continue from the last checkpoint. With --listen port the image is
+	// rendered by worker processes started with --worker host:port.
+	const char* modelFile = NULL;
+	const char* scriptFile = NULL;
+	const char* workerAddress = NULL;
+	int listenPort = 0;
+	bool resume = false;
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--script" && i + 1 < argc) {
+			scriptFile = argv[++i];
+		} else if (string(argv[i]) == "--resume") {
+			resume = true;
+		} else if (string(argv[i]) == "--listen" && i + 1 < argc) {
+			listenPort = atoi(argv[++i]);
+		} else if (string(argv[i]) == "--worker" && i + 1 < argc) {
+			workerAddress = argv[++i];
+		} else {
+			modelFile = argv[i];
+		}
+	}
+	if ((listenPort || workerAddress) && (scriptFile || resume)) {
+		cout << "--script and --resume can not be used with --listen or --worker." << endl;
+		return 1;
+	}
+
+	// Initialise sample grid and cost buffer
 	for (int y = 0; y < SCREEN_HEIGHT; y++) {
 		for (int x = 0; x < SCREEN_WIDTH; x++) {
-			bufferCount[y][x] = 0;
-			buffer[y][x].color = vec3(0, 0, 0);
-			for (int i = 0; i < SAMPLE; i++) {
-				for (int j = 0; j < SAMPLE; j++) {
-					pixelGrid[y][x][i][j] = false;
-				}
-			}
+			costBuffer[y][x] = 0;
 		}
 	}
+	Restart();
 
-	// Initialise screen
-	screen = InitializeSDL( SCREEN_WIDTH, SCREEN_HEIGHT );
+	// Initialise screen; workers have none
+	if (!workerAddress) {
+		screen = InitializeSDL( SCREEN_WIDTH, SCREEN_HEIGHT );
+	}
 
 	// Load triangles (timed)
 	t = SDL_GetTicks();
 
-	vector<Triangle> triangles;
-	LoadTestModel(triangles);
-	for (unsigned int i = 0; i < triangles.size(); i++) {
-		primitives.push_back(&triangles[i]);
-	}
+	Mesh mesh;
+	LoadTestModel(mesh);
+	mesh.BuildBVH();
+	scene.Add(&mesh);
 
 	// Glass ball
-	Sphere s1(vec3(0.3, 0.7, -0.5), 0.20, vec3(1, 1, 1));
-	s1.material.isRefractive = true;
-	s1.material.refractRoughness = 0;
-	s1.material.reflectStrength = 1.5;
-	s1.material.specularExponent = 0;
-	s1.material.ior = 1;
-	primitives.push_back(&s1);
+	Material glass;
+	glass.diffuse = vec3(1, 1, 1);
+	glass.isRefractive = true;
+	glass.refractRoughness = 0;
+	glass.reflectStrength = 1.5;
+	glass.ior = 1;
+	Sphere s1(vec3(0.3, 0.7, -0.5), 0.20, MaterialTable::Add(glass));
 
 	// Metal ball
-	Sphere s2(vec3(-0.5, 0.7, -0.5), 0.3, vec3(0.5,0.5,1));
-	s2.material.isReflective = true;
-	s2.material.reflectStrength = 1;
-	s2.material.reflectRoughness = 0;
-	s2.material.specularExponent = 0;
-	primitives.push_back(&s2);
+	Material metal;
+	metal.diffuse = vec3(0.5,0.5,1);
+	metal.isReflective = true;
+	metal.reflectStrength = 1;
+	metal.reflectRoughness = 0;
+	Sphere s2(vec3(-0.5, 0.7, -0.5), 0.3, MaterialTable::Add(metal));
 
 	// Diffuse ball
-	Sphere s3(vec3(0.5, 0.75, 0.3), 0.25, vec3(1,1,1));
-	primitives.push_back(&s3);
+	Material white;
+	white.diffuse = vec3(1,1,1);
+	MaterialId whiteId = MaterialTable::Add(white);
+	Sphere s3(vec3(0.5, 0.75, 0.3), 0.25, whiteId);
+
+	// A model given on the command line replaces the balls. The imported
+	// and prepared model is cached next to it, so later runs only map it.
+	// It is placed MODEL_GRID x MODEL_GRID times, all sharing one mesh.
+	Mesh model;
+	SceneCache cache;
+	Pager pager;
+	vector<MeshInstance> instances;
+	vector<Primitive*> movable;
+	size_t modelBytes = 0;
+	int importTime = 0;
+	bool cached = false;
+	if (modelFile) {
+		string cacheFile = string(modelFile) + ".cache";
+		cached = cache.Load(cacheFile.c_str(), modelFile, model);
+
+		if (!cached) {
+			importTime = SDL_GetTicks();
+			if (!MeshLoader::Load(modelFile, model, whiteId, modelBytes)) {
+				return 1;
+			}
+			importTime = SDL_GetTicks() - importTime;
+
+			// Same handedness as the test model, standing on the floor of the
+			// room. Turning half a circle about z keeps the winding, so the
+			// normals turn with the vertices.
+			for (size_t i = 0; i < model.vertices.size(); i++) {
+				model.vertices[i].x *= -1;
+				model.vertices[i].y *= -1;
+			}
+			for (size_t i = 0; i < model.normals.size(); i++) {
+				model.normals[i].x *= -1;
+				model.normals[i].y *= -1;
+			}
+			model.Fit(vec3(-0.6, -0.2, -0.6), vec3(0.6, 1, 0.6));
+			if (!model.BuildBVH()) {
+				cout << modelFile << " has more than " << BVH::MAX_ITEMS
+				     << " triangles, too many for this build's BVH." << endl;
+				return 1;
+			}
+
+			// Render from the cache as well, so the geometry can be paged
+			if (SceneCache::Save(cacheFile.c_str(), modelFile, model)) {
+				cache.Load(cacheFile.c_str(), modelFile, model);
+			} else {
+				cout << "Could not write " << cacheFile << endl;
+			}
+		}
+
+		if (cache.IsOpen()) {
+			pager.Attach(cache.File(), (size_t) GEOMETRY_CAP_MB << 20);
+			model.pager = &pager;
+		}
+
+		// Shrink each copy towards the floor and move it to its cell
+		float scale = 1.f / MODEL_GRID;
+		for (int i = 0; i < MODEL_GRID; i++) {
+			for (int j = 0; j < MODEL_GRID; j++) {
+				vec3 cell(
+					-0.6 + 1.2 * (i + 0.5f) * scale,
+					1 - scale,
+					-0.6 + 1.2 * (j + 0.5f) * scale
+				);
+				instances.push_back(MeshInstance(&model, mat3(scale), cell));
+			}
+		}
+		for (size_t i = 0; i < instances.size(); i++) {
+			movable.push_back(&instances[i]);
+		}
+	} else {
+		movable.push_back(&s1);
+		movable.push_back(&s2);
+		movable.push_back(&s3);
+	}
+	for (size_t i = 0; i < movable.size(); i++) {
+		scene.Add(movable[i]);
+	}
+	scene.Build();
+
+	// The workers' lights share the light list, so this adds to theirs too
+	float cellWidth = 1.8f / std::max(LIGHT_GRID, 1);
+	for (int i = 0; i < LIGHT_GRID; i++) {
+		for (int j = 0; j < LIGHT_GRID; j++) {
+			vec3 position(-0.9 + cellWidth * (i + 0.5f), light.position.y, -0.9 + cellWidth * (j + 0.5f));
+			float gap = light.width / 2 + cellWidth / 4;
+			if (fabs(position.x) < gap && fabs(position.z) < gap) {
+				continue;
+			}
+			light.lights->Add(SquareEmitter(
+				position, light.color / (float) (LIGHT_GRID * LIGHT_GRID), cellWidth / 2
+			));
+		}
+	}
+	light.lights->Build();
+	if (IRRADIANCE_CACHE) {
+		light.irradiance->Reserve(1 << 18);
+	}
 
 	t2 = SDL_GetTicks();
 	dt = float(t2-t);
-	cout << "Loaded model in: " << dt << " ms." << endl;
+	cout << "Loaded model in: " << dt << " ms";
+	if (cached) {
+		cout << " (" << model.faces.size() << " triangles x " << instances.size()
+		     << ", from cache)";
+	} else if (modelFile) {
+		cout << " (" << model.faces.size() << " triangles x " << instances.size()
+		     << ", imported at " << modelBytes / 1e3 / std::max(importTime, 1) << " MB/s)";
+	}
+	cout << "." << endl;
+	if (modelFile) {
+		cout << "Model BVH: " << model.bvh.nodes.size() << " nodes, "
+		     << model.bvh.Memory() / 1024 << " KB." << endl;
+		if (BVH_BENCHMARK_RAYS > 0) {
+			BenchmarkBVH(model);
+		}
+	}
 
 	cam.Rotate(-0.4);
 
+	// Workers and the coordinator only work together if they set up the
+	// same scene
+	TileHello hello;
+	hello.width = SCREEN_WIDTH;
+	hello.height = SCREEN_HEIGHT;
+	hello.tiles = BUCKET_RATIO * BUCKET_RATIO;
+	hello.samples = SAMPLE;
+	hello.scene = SceneFingerprint();
+
+	if (workerAddress) {
+		EmitPhotons();
+		return RunWorker(workerAddress, hello) ? 0 : 1;
+	}
+
+	// In batch mode the script's frames are rendered one after the other,
+	// each for its number of passes, keeping everything loaded so far
+	AnimationScript script;
+	if (scriptFile) {
+		if (!script.Load(scriptFile, cam.position, cam.yaw, cam.pitch,
+		                 SAMPLE * SAMPLE, SAMPLE * SAMPLE)) {
+			return 1;
+		}
+		for (size_t i = 0; i < script.frames.size(); i++) {
+			for (size_t j = 0; j < script.frames[i].moves.size(); j++) {
+				if (script.frames[i].moves[j].object >= (int) movable.size()) {
+					cout << scriptFile << ": there are only " << movable.size()
+					     << " objects to move." << endl;
+					return 1;
+				}
+			}
+		}
+		if (script.frames.empty()) {
+			cout << scriptFile << ": no frames to render." << endl;
+			return 0;
+		}
+		if (SetFrame(script.frames[0], movable)) {
+			scene.Update();
+		}
+	}
+	bool batch = !script.frames.empty();
+	size_t frame = 0;
+
+	SceneHash checkpointHash;
+	checkpointHash.Add(SceneFingerprint());
+	for (size_t i = 0; i < script.frames.size(); i++) {
+		const AnimationScript::Frame& f = script.frames[i];
+		checkpointHash.Add(f.cameraPosition);
+		checkpointHash.Add(f.yaw);
+		checkpointHash.Add(f.pitch);
+		checkpointHash.Add(f.passes);
+		for (size_t j = 0; j < f.moves.size(); j++) {
+			checkpointHash.Add(f.moves[j].object);
+			checkpointHash.Add(f.moves[j].position);
+		}
+	}
+	checkpointScene = checkpointHash.value;
+
+	// Passes in the current image, which is finished after imagePasses
+	int passes = 0;
+	int imagePasses = batch ? script.frames[0].passes : SAMPLE * SAMPLE;
+
+	if (resume && Resume(batch ? script.frames.size() : 1, frame, passes)) {
+		if (batch) {
+			bool moved = false;
+			for (size_t i = 1; i <= frame; i++) {
+				moved = SetFrame(script.frames[i], movable) || moved;
+			}
+			if (moved) {
+				scene.Update();
+			}
+			imagePasses = script.frames[frame].passes;
+		}
+		cout << "Resumed from " << CHECKPOINT_FILE << ": ";
+		if (batch) {
+			cout << "frame " << frame + 1 << ", ";
+		}
+		cout << passes << " of " << imagePasses << " passes." << endl;
+	}
+	int lastCheckpoint = SDL_GetTicks();
+
+	EmitPhotons();
+	ResetGuide();
+
 	// Create screen mutex and threads
 	thread threads[NUM_THREAD];
 	mut = SDL_CreateMutex();
-	sem = SDL_CreateSemaphore(BUCKET_RATIO * BUCKET_RATIO);
+	passDone = SDL_CreateCond();
+	for (int i = 0; i < BUCKET_RATIO * BUCKET_RATIO; i++) {
+		tileSem[i] = SDL_CreateSemaphore(passes < imagePasses ? 1 : 0);
+	}
 
-	for (int i = 0; i < NUM_THREAD; i++) {
-		threads[i] = thread(DrawBox, i);
+	unique_ptr<TileCoordinator> coordinator;
+	if (listenPort) {
+		coordinator.reset(new TileCoordinator(accumulation, imagePasses, hello));
+		if (!coordinator->Listen(listenPort)) {
+			cout << "Could not listen on port " << listenPort << endl;
+			return 1;
+		}
+		cout << "Waiting for workers on port " << listenPort << "." << endl;
+	} else {
+		for (int i = 0; i < NUM_THREAD; i++) {
+			threads[i] = thread(DrawBox, i);
+		}
 	}
 
-	// Start event loop to listen for exit events
+	// Start event loop to listen for exit events. Sleep until the workers
+	// finish a pass, waking up every DISPLAY_INTERVAL to handle input and to
+	// show the buckets that have finished so far.
 	t = SDL_GetTicks();
 	while( NoQuitMessageSDL() )
 	{
-		// Update();
-		if (completedBucket == BUCKET_RATIO * BUCKET_RATIO) {
+		SDL_mutexP(mut);
+		if (completedBucket < BUCKET_RATIO * BUCKET_RATIO) {
+			SDL_CondWaitTimeout(passDone, mut, DISPLAY_INTERVAL);
+		}
+		SDL_mutexV(mut);
+
+		bool passComplete = completedBucket == BUCKET_RATIO * BUCKET_RATIO;
+		if (!DENOISE) {
 			Draw();
+		} else if (passComplete || (coordinator && coordinator->PassesDone() > passes)) {
+			DrawDenoised();
+		}
+
+		// Workers in other processes render whole tiles at their own pace;
+		// report a pass once every tile has it
+		if (coordinator && coordinator->PassesDone() > passes) {
+			t2 = SDL_GetTicks();
+			dt = float(t2-t);
+			t = t2;
+			passes = coordinator->PassesDone();
+			cout << "Frame rendered in: " << dt << " ms (pass " << passes << ")." << endl;
+		}
+
+		if (pager.Attached()) {
+			pager.Enforce();
+		}
+
+		if (passComplete) {
+			t2 = SDL_GetTicks();
+			dt = float(t2-t);
+			t = t2;
+			cout << "Frame rendered in: " << dt << " ms." << endl;
+			if (pager.Attached()) {
+				pager.Report();
+			}
+
+			passes++;
+			if (PATH_GUIDING && light.guide->EndPass(GUIDE_TRAINING_PASSES)) {
+				cout << "Path guide: " << light.guide->Regions() << " regions";
+				cout << (light.guide->Recording() ? "." : ", trained.") << endl;
+			}
+
+			// The workers are all waiting for the next pass, so the scene
+			// and the accumulated image can be changed safely
+			if (batch && passes == imagePasses) {
+				char name[32];
+				snprintf(name, sizeof(name), "frame_%04d", (int) frame + 1);
+				SDL_SaveBMP( screen, (string(name) + ".bmp").c_str() );
+				cout << "Saved " << name << ".bmp." << endl;
+				if (AOV) {
+					SaveAOV(name);
+				}
+
+				if (++frame == script.frames.size()) {
+					break;
+				}
+				if (SetFrame(script.frames[frame], movable)) {
+					if (scene.Update()) {
+						cout << "Scene BVH rebuilt." << endl;
+					}
+					light.irradiance->Clear();
+					EmitPhotons();
+					ResetGuide();
+				}
+				Restart();
+				passes = 0;
+				imagePasses = script.frames[frame].passes;
+			} else if (!batch && (ANIMATE || INTERACTIVE) && Update()) {
+				if (scene.Update()) {
+					cout << "Scene BVH rebuilt." << endl;
+				}
+				if (ANIMATE) {
+					light.irradiance->Clear();
+					EmitPhotons();
+				}
+				Restart();
+				passes = 0;
+			}
+
+			if (CHECKPOINT_INTERVAL > 0 &&
+			    t2 - lastCheckpoint >= CHECKPOINT_INTERVAL * 1000) {
+				SaveCheckpoint(frame, passes);
+				lastCheckpoint = t2;
+			}
+
 			completedBucket = 0;
-			for (int i = 0; i < BUCKET_RATIO * BUCKET_RATIO; i++) {
-				SDL_SemPost(sem);
+			if (passes < imagePasses) {
+				for (int i = 0; i < BUCKET_RATIO * BUCKET_RATIO; i++) {
+					SDL_SemPost(tileSem[i]);
+				}
 			}
 		}
 	}
@@ -150,42 +596,402 @@ int main( int argc, char* argv[] )
 	toExit = 1;
 
 	for (int i = 0; i < BUCKET_RATIO * BUCKET_RATIO; i++) {
-		SDL_SemPost(sem);
+		SDL_SemPost(tileSem[i]);
 	}
 
 	for (int i = 0; i < NUM_THREAD; i++) {
-		threads[i].join();
+		if (threads[i].joinable()) {
+			threads[i].join();
+		}
+	}
+	if (coordinator) {
+		coordinator->Stop();
 	}
 
 	// Destroy mutex and save image
+	SDL_DestroyCond(passDone);
 	SDL_DestroyMutex(mut);
 
 	SDL_SaveBMP( screen, "screenshot.bmp" );
+	if (AOV && !coordinator) {
+		SaveAOV("screenshot");
+	}
+
+	if (TRACE) {
+		trace.Save("trace.json", NUM_THREAD);
+	}
+
+	if (HEATMAP) {
+		Heatmap::Save("heatmap.bmp", costBuffer, "us");
+	}
 
 	return 0;
 }
 
-void Update()
+/* Starts a new image: drops the accumulated samples and the record of which
+strata were sampled. Only call while no worker is rendering. */
+void Restart()
 {
-	// Compute frame time:
-	t2 = SDL_GetTicks();
-	dt = float(t2-t);
-	t = t2;
+	accumulation.Clear();
+	if (AOV || DENOISE) {
+		aov.Clear();
+	}
+	for (int i = 0; i < BUCKET_RATIO * BUCKET_RATIO; i++) {
+		drawnVersion[i] = 0;
+		for (int y = 0; y < SAMPLE; y++) {
+			for (int x = 0; x < SAMPLE; x++) {
+				pixelGrid[i][y][x] = false;
+			}
+		}
+	}
+}
+
+/* Writes the AOVs as prefix_depth.pfm and so on. Only call between passes. */
+void SaveAOV(const string& prefix)
+{
+	if (aov.Save(prefix)) {
+		cout << "Saved " << prefix << "_*.pfm." << endl;
+	} else {
+		cout << "Could not write " << prefix << "_*.pfm" << endl;
+	}
+}
+
+/* Starts writing the render's progress to CHECKPOINT_FILE. Only call between
+passes. */
+void SaveCheckpoint(int frame, int passes)
+{
+	Checkpoint::State state;
+	state.width = SCREEN_WIDTH;
+	state.height = SCREEN_HEIGHT;
+	state.tiles = BUCKET_RATIO * BUCKET_RATIO;
+	state.samples = SAMPLE;
+	state.scene = checkpointScene;
+	state.frame = frame;
+	state.passes = passes;
+
+	state.texels.resize(SCREEN_WIDTH * SCREEN_HEIGHT);
+	accumulation.Save(state.texels.data());
+	const bool* strata = &pixelGrid[0][0][0];
+	state.strata.assign(strata, strata + state.tiles * SAMPLE * SAMPLE);
+
+	// The sampling generator, then the workers' light generators
+	ostringstream out;
+	out << generator;
+	state.generators.push_back(out.str());
+	for (int i = 0; i < NUM_THREAD; i++) {
+		ostringstream out;
+		out << workerLight[i].generator;
+		state.generators.push_back(out.str());
+	}
+
+	if (!checkpoint.Save(CHECKPOINT_FILE, state)) {
+		cout << "Skipped a checkpoint, the previous one is still being written." << endl;
+	}
+}
+
+/* Restores the progress saved in CHECKPOINT_FILE, returning its frame (of
+`frames`) and number of passes. Leaves everything alone if there is no usable
+checkpoint for this render. Call before the workers start. */
+bool Resume(int frames, size_t& frame, int& passes)
+{
+	Checkpoint::State state;
+	state.width = SCREEN_WIDTH;
+	state.height = SCREEN_HEIGHT;
+	state.tiles = BUCKET_RATIO * BUCKET_RATIO;
+	state.samples = SAMPLE;
+	state.scene = checkpointScene;
+
+	bool ok = Checkpoint::Load(CHECKPOINT_FILE, state) &&
+		state.generators.size() == NUM_THREAD + 1 &&
+		state.frame >= 0 && state.frame < frames &&
+		state.passes >= 0 && state.passes <= SAMPLE * SAMPLE;
 
-	// cout << "Render time: " << dt << " ms." << endl;
+	// Parse the generators before changing anything
+	default_random_engine generators[NUM_THREAD + 1];
+	for (int i = 0; ok && i <= NUM_THREAD; i++) {
+		istringstream in(state.generators[i]);
+		ok = (bool) (in >> generators[i]);
+	}
+	if (!ok) {
+		cout << "No checkpoint of this render in " << CHECKPOINT_FILE
+		     << ", starting from scratch." << endl;
+		return false;
+	}
+
+	accumulation.Load(state.texels.data());
+	copy(state.strata.begin(), state.strata.end(), &pixelGrid[0][0][0]);
+	generator = generators[0];
+	for (int i = 0; i < NUM_THREAD; i++) {
+		workerLight[i].generator = generators[i + 1];
+	}
+	frame = state.frame;
+	passes = state.passes;
+	return true;
+}
+
+/* Renders tiles for the coordinator at `address`, on one connection per core,
+until it has no more work */
+bool RunWorker(const string& address, const TileHello& hello)
+{
+	// Processes must not share random sequences
+	generator.seed(random_device()());
+
+	int numThreads = std::max(1, std::min((int) thread::hardware_concurrency(), NUM_THREAD));
+	vector<thread> threads;
+	atomic<int> failed(0);
+	for (int i = 0; i < numThreads; i++) {
+		threads.push_back(thread([&, i]() {
+			bool ok = TileWorker::Run(address, hello,
+				[](int tile) {
+					int x1, y1, x2, y2;
+					accumulation.TileBounds(tile, x1, y1, x2, y2);
+					return (x2 - x1) * (y2 - y1);
+				},
+				[i](const TileJob& job, vector<vec3>& pass) {
+					workerLight[i].generator.seed(job.seed);
+					RenderPass(job.tile, workerLight[i], SAMPLE, job.stratum, pass, NULL);
+				}
+			);
+			failed += !ok;
+		}));
+	}
+	for (int i = 0; i < numThreads; i++) {
+		threads[i].join();
+	}
+	return failed == 0;
+}
+
+/* Puts the camera and objects where a frame of the script has them. Returns
+true if any object moved, in which case the scene has to be updated. */
+bool SetFrame(const AnimationScript::Frame& frame, const vector<Primitive*>& movable)
+{
+	cam.position = frame.cameraPosition;
+	cam.yaw = frame.yaw;
+	cam.pitch = frame.pitch;
+
+	for (size_t i = 0; i < frame.moves.size(); i++) {
+		Primitive* p = movable[frame.moves[i].object];
+		if (p->isSphere) {
+			((Sphere*) p)->position = frame.moves[i].position;
+		} else if (p->isInstance) {
+			MeshInstance* instance = (MeshInstance*) p;
+			instance->Place(instance->linear, frame.moves[i].position);
+		}
+	}
+	return !frame.moves.empty();
+}
+
+/* Times BVH_BENCHMARK_RAYS rays from around the mesh's box to random points
+inside it, nearest hit only, without the pager's bookkeeping */
+void BenchmarkBVH(const Mesh& mesh)
+{
+	// From the vertices, since the compressed root's box is a little larger
+	vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		lo = glm::min(lo, mesh.vertices[i]);
+		hi = glm::max(hi, mesh.vertices[i]);
+	}
+	vec3 centre = (lo + hi) * 0.5f;
+	float radius = length(hi - lo);
+
+	default_random_engine rng(1);
+	uniform_real_distribution<float> uniform(0, 1);
+	vector<Ray> rays(BVH_BENCHMARK_RAYS);
+	for (size_t i = 0; i < rays.size(); i++) {
+		vec3 s;
+		do {
+			s = vec3(uniform(rng), uniform(rng), uniform(rng)) * 2.f - 1.f;
+		} while (dot(s, s) > 1 || dot(s, s) < 1e-4f);
+		s = centre + normalize(s) * radius;
+		vec3 target = lo + vec3(uniform(rng), uniform(rng), uniform(rng)) * (hi - lo);
+		rays[i] = Ray(s, normalize(target - s));
+	}
+
+	int start = SDL_GetTicks();
+	int hits = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		const Ray& ray = rays[i];
+		float closest = numeric_limits<float>::max();
+		bool hit = false;
+		mesh.bvh.Traverse(ray.s, ray.d, closest, [&](int face) {
+			hit |= Intersection::IntersectFace(ray, &mesh, face, -1, closest);
+		});
+		hits += hit;
+	}
+	int ms = std::max((int) SDL_GetTicks() - start, 1);
+
+#ifdef BVH_COMPRESSED
+	const char* layout = "compressed";
+#else
+	const char* layout = "binary";
+#endif
+	cout << "Model BVH (" << layout << "): " << rays.size() / (ms * 1e3f)
+	     << " Mrays/s, " << hits << " of " << rays.size() << " rays hit." << endl;
+}
+
+/* Traces PHOTONS photons on the workers' lights, in parallel, into the photon
+maps they all share. Only call between passes. */
+void EmitPhotons()
+{
+	if (PHOTONS == 0) {
+		return;
+	}
+	int begin = SDL_GetTicks();
+
+	vector<Photon> caustic[NUM_THREAD], bounced[NUM_THREAD];
+	thread threads[NUM_THREAD];
+	for (int i = 0; i < NUM_THREAD; i++) {
+		int count = PHOTONS / NUM_THREAD + (i < PHOTONS % NUM_THREAD);
+		threads[i] = thread([i, count, &caustic, &bounced]() {
+			workerLight[i].TracePhotons(scene, count, PHOTONS, 10, caustic[i], bounced[i]);
+		});
+	}
+
+	vector<Photon> allCaustic, allBounced;
+	for (int i = 0; i < NUM_THREAD; i++) {
+		threads[i].join();
+		allCaustic.insert(allCaustic.end(), caustic[i].begin(), caustic[i].end());
+		allBounced.insert(allBounced.end(), bounced[i].begin(), bounced[i].end());
+	}
+	cout << "Traced " << PHOTONS << " photons in " << SDL_GetTicks() - begin << " ms: "
+	     << allCaustic.size() << " caustic, " << allBounced.size() << " bounced." << endl;
+
+	light.caustics->Build(allCaustic, PHOTON_RADIUS);
+	light.indirect->Build(allBounced, PHOTON_RADIUS);
+}
+
+/* Starts learning the path guide afresh for the scene as it is now. Only call
+between passes. */
+void ResetGuide()
+{
+	if (!PATH_GUIDING) {
+		return;
+	}
+	vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+	for (size_t i = 0; i < scene.primitives.size(); i++) {
+		vec3 primitiveLo, primitiveHi;
+		Scene::Bounds(scene.primitives[i], primitiveLo, primitiveHi);
+		lo = glm::min(lo, primitiveLo);
+		hi = glm::max(hi, primitiveHi);
+	}
+	light.guide->Reset(lo, hi);
+}
+
+/* Hashes everything a pass depends on: the geometry, materials and
+textures, the camera and the light, the grids the lights and models are
+laid out on, and the settings that change what a sample adds up to. A mesh
+shared by several instances is hashed once. */
+uint32_t SceneFingerprint()
+{
+	SceneHash hash;
+	hash.Add(LIGHT_GRID);
+	hash.Add(MODEL_GRID);
+	hash.Add(HEATMAP);
+	hash.Add(PHOTONS);
+	hash.Add(PHOTON_RADIUS);
+	hash.Add(IRRADIANCE_CACHE);
+	hash.Add(PATH_GUIDING);
+	hash.Add(GUIDE_TRAINING_PASSES);
+
+	for (size_t i = 0; i < MaterialTable::materials.size(); i++) {
+		const Material& material = MaterialTable::materials[i];
+		hash.Add(material.diffuse);
+		hash.Add(material.isReflective);
+		hash.Add(material.reflectStrength);
+		hash.Add(material.reflectRoughness);
+		hash.Add(material.isRefractive);
+		hash.Add(material.ior);
+		hash.Add(material.refractRoughness);
+		const SDL_Surface* images[2] = {material.textureImage, material.normalMapImage};
+		for (int j = 0; j < 2; j++) {
+			if (images[j] != NULL) {
+				hash.Add(images[j]->pixels, (size_t) images[j]->h * images[j]->pitch);
+			}
+		}
+	}
+
+	const Mesh* lastMesh = NULL;
+	for (size_t i = 0; i < scene.primitives.size(); i++) {
+		const Primitive* primitive = scene.primitives[i];
+		hash.Add(primitive->materialId);
+		const Mesh* mesh = NULL;
+		if (primitive->isSphere) {
+			const Sphere* sphere = (const Sphere*) primitive;
+			hash.Add(sphere->position);
+			hash.Add(sphere->radius);
+		} else if (primitive->isTriangle) {
+			const Triangle* triangle = (const Triangle*) primitive;
+			hash.Add(triangle->v0);
+			hash.Add(triangle->v1);
+			hash.Add(triangle->v2);
+		} else if (primitive->isInstance) {
+			const MeshInstance* instance = (const MeshInstance*) primitive;
+			hash.Add(instance->linear);
+			hash.Add(instance->translation);
+			mesh = instance->mesh;
+		} else if (primitive->isMesh) {
+			mesh = (const Mesh*) primitive;
+		}
+		if (mesh != NULL && mesh != lastMesh) {
+			hash.Add(mesh->vertices.data(), mesh->vertices.size() * sizeof(vec3));
+			hash.Add(mesh->uvs.data(), mesh->uvs.size() * sizeof(vec2));
+			hash.Add(mesh->faces.data(), mesh->faces.size() * sizeof(MeshFace));
+			lastMesh = mesh;
+		}
+	}
+
+	hash.Add(cam.focalLength);
+	hash.Add(cam.position);
+	hash.Add(cam.yaw);
+	hash.Add(cam.pitch);
+	hash.Add(light.position);
+	hash.Add(light.color);
+	hash.Add(light.width);
+	return hash.value;
+}
+
+/* Moves the camera and the scene by the time the last pass took (dt). Called
+between passes; returns true if anything moved. */
+bool Update()
+{
+	bool moved = false;
+
+	if (ANIMATE) {
+		moved = true;
+		float angle = ANIMATE_SPEED * (dt / 1000.0);
+		mat3 rotation(1.0);
+		rotation[0][0] = cos(angle);
+		rotation[2][0] = sin(angle);
+		rotation[0][2] = -sin(angle);
+		rotation[2][2] = cos(angle);
+		for (size_t i = 0; i < scene.primitives.size(); i++) {
+			Primitive* p = scene.primitives[i];
+			if (p->isSphere) {
+				Sphere* sphere = (Sphere*) p;
+				sphere->position = rotation * sphere->position;
+			} else if (p->isInstance) {
+				MeshInstance* instance = (MeshInstance*) p;
+				instance->Place(rotation * instance->linear, rotation * instance->translation);
+			}
+		}
+	}
 
 	if (INTERACTIVE) {
 		Uint8* keyState = SDL_GetKeyState(0);
 		if (keyState[SDLK_UP]) {
+			moved = true;
 			cam.Translate(vec3(0, 0, cam.speed * (dt / 1000.0)));
 		}
 		if (keyState[SDLK_DOWN]) {
+			moved = true;
 			cam.Translate(vec3(0, 0, -cam.speed * (dt / 1000.0)));
 		}
 		if (keyState[SDLK_LEFT]) {
+			moved = true;
 			cam.Rotate(cam.rSpeed * (dt / 1000.0));
 		}
 		if (keyState[SDLK_RIGHT]) {
+			moved = true;
 			cam.Rotate(-cam.rSpeed * (dt / 1000.0));
 		}
 		// if (keyState[SDLK_w]) {
@@ -207,22 +1013,91 @@ void Update()
 		//     light.position += cam.down * (float)(dt / 1000.0);
 		// }
 	}
+
+	return moved;
 }
 
 void Draw()
 {
-	t2 = SDL_GetTicks();
-	dt = float(t2-t);
-	cout << "Frame rendered in: " << dt << " ms." << endl;
+	int64_t traceBegin = TRACE ? trace.Now() : 0;
 
-	// Lock screen surface and draw buffer onto screen
+	SDL_Rect dirty[BUCKET_RATIO * BUCKET_RATIO];
+	int numDirty = 0;
+
+	// Lock screen surface and draw the tiles that received new samples since
+	// the last refresh, from a consistent copy of each
+	if( SDL_MUSTLOCK( screen ) )
+	SDL_LockSurface( screen );
+
+	for (int i = 0; i < accumulation.NumTiles(); i++) {
+		if (accumulation.Version(i) == drawnVersion[i]) {
+			continue;
+		}
+		drawnVersion[i] = accumulation.Snapshot(i, snapshot);
+
+		int x1, y1, x2, y2;
+		accumulation.TileBounds(i, x1, y1, x2, y2);
+		for (int y = y1; y < y2; y++) {
+			Uint32* row = (Uint32*) screen->pixels + y * screen->pitch / 4;
+			AccumulationBuffer::ResolveRow(
+				&snapshot[y][x1], x2 - x1, row + x1, screen->format
+			);
+		}
+
+		dirty[numDirty].x = x1;
+		dirty[numDirty].y = y1;
+		dirty[numDirty].w = x2 - x1;
+		dirty[numDirty].h = y2 - y1;
+		numDirty++;
+	}
+
+	if( SDL_MUSTLOCK( screen ) )
+	SDL_UnlockSurface( screen );
+
+	if (numDirty > 0) {
+		SDL_UpdateRects( screen, numDirty, dirty );
+	}
+
+	if (TRACE) {
+		trace.Record(NUM_THREAD, "Draw", traceBegin, numDirty);
+	}
+}
+
+/* Filters the whole image and draws it. Only call between passes, when the
+guides are not being written. */
+void DrawDenoised()
+{
+	int64_t traceBegin = TRACE ? trace.Now() : 0;
+
+	for (int i = 0; i < accumulation.NumTiles(); i++) {
+		drawnVersion[i] = accumulation.Snapshot(i, snapshot);
+	}
+	for (int y = 0; y < SCREEN_HEIGHT; y++) {
+		for (int x = 0; x < SCREEN_WIDTH; x++) {
+			vec3 color = snapshot[y][x].Resolve();
+			for (int c = 0; c < 3; c++) {
+				denoiser.color[c][y * SCREEN_WIDTH + x] = color[c];
+			}
+		}
+	}
+
+	denoiser.Filter(std::max(1u, thread::hardware_concurrency()), aov);
+
+	// Draw the result as texels of one sample each
 	if( SDL_MUSTLOCK( screen ) )
 	SDL_LockSurface( screen );
 
+	AccumulationBuffer::Texel row[SCREEN_WIDTH];
 	for (int y = 0; y < SCREEN_HEIGHT; y++) {
 		for (int x = 0; x < SCREEN_WIDTH; x++) {
-			PutPixelSDL(screen, x, y, buffer[y][x].color / (float)(bufferCount[y][x]));
+			for (int c = 0; c < 3; c++) {
+				row[x].color[c] = denoiser.color[c][y * SCREEN_WIDTH + x];
+			}
+			row[x].count = 1;
 		}
+		AccumulationBuffer::ResolveRow(
+			row, SCREEN_WIDTH, (Uint32*) screen->pixels + y * screen->pitch / 4, screen->format
+		);
 	}
 
 	if( SDL_MUSTLOCK( screen ) )
@@ -230,97 +1105,137 @@ void Draw()
 
 	SDL_UpdateRect( screen, 0, 0, 0, 0 );
 
-	t = SDL_GetTicks();
+	if (TRACE) {
+		trace.Record(NUM_THREAD, "Denoise", traceBegin, 0);
+	}
 }
 
 void DrawBox(int n)
 {
-	DrawBucket(n, light, SAMPLE);
+	DrawBucket(n, workerLight[n], SAMPLE);
 }
 
-void DrawBucket(int n, FlatSquareLight light, int sample)
+void DrawBucket(int n, FlatSquareLight& light, int sample)
 {
 	// Calculate the the top left and bottom right corners of the bucket
 	int x1, x2, y1, y2;
-	y1 = (n / BUCKET_RATIO) * SCREEN_HEIGHT / BUCKET_RATIO;
-	y2 = (n / BUCKET_RATIO + 1) * SCREEN_HEIGHT / BUCKET_RATIO;
-	x1 = (n % BUCKET_RATIO) * SCREEN_WIDTH / BUCKET_RATIO;
-	x2 = (n % BUCKET_RATIO + 1) * SCREEN_WIDTH / BUCKET_RATIO;
+	accumulation.TileBounds(n, x1, y1, x2, y2);
 
-	vec3 rayDir, color;
-	bool found = false;
-	Intersection pointIntersect;
+	// Samples of the current pass, committed to the accumulation buffer once
+	// the whole bucket is done
+	vector<vec3> pass((x2 - x1) * (y2 - y1));
+
+	// Super sampling each pixel, one pass per stratum, until told to exit.
+	// The display thread only lets a pass start while the image has unused
+	// strata left.
+	for (int s = 0; !toExit; s++) {
 
-	// Super sampling each pixel
-	for (int s = 0; s < sample * sample && !toExit; s++) {
+		int64_t traceBegin = TRACE ? trace.Now() : 0;
+		SDL_SemWait(tileSem[n]);
+		if (TRACE) {
+			trace.Record(n, "Wait", traceBegin, s);
+			traceBegin = trace.Now();
+		}
+		if (toExit) {
+			break;
+		}
 
 		int randS, gridX, gridY;
 		do {
 			randS = distribution(generator) * sample * sample;
 			gridX = randS % sample;
 			gridY = randS / sample;
-		} while (pixelGrid[y1][x1][gridY][gridX] && !toExit);
+		} while (pixelGrid[n][gridY][gridX] && !toExit);
+		if (toExit) {
+			break;
+		}
+		pixelGrid[n][gridY][gridX] = true;
 
-		float dX = -0.5 + (randS % sample) / (float) sample;
-		float dY = -0.5 + (randS / sample) / (float) sample;
+		RenderPass(n, light, sample, randS, pass, AOV || DENOISE ? &aov : NULL);
 
-		SDL_SemWait(sem);
+		if (!toExit) {
+			accumulation.Commit(n, pass);
+		}
 
-		// Calculate color for every pixel in bucket
-		for (int y = y1; y < y2 && !toExit; y++) {
-			for (int x = x1; x < x2 && !toExit; x++) {
+		if (TRACE) {
+			trace.Record(n, "Tile pass", traceBegin, s);
+		}
 
-				pixelGrid[y][x][gridY][gridX] = true;
+		// The last bucket of the pass wakes up the display thread. Signal
+		// under the mutex so the wake-up cannot slip in between its check and
+		// its wait.
+		if (++completedBucket == BUCKET_RATIO * BUCKET_RATIO) {
+			SDL_mutexP(mut);
+			SDL_CondSignal(passDone);
+			SDL_mutexV(mut);
+		}
 
-				// Calculate ray direction and create ray
-				float randX = (1.f / sample) * distribution(generator);
-				float randY = (1.f / sample) * distribution(generator);
-				rayDir = vec3(
-					x - SCREEN_WIDTH / 2.0 + dX + randX,
-					y - SCREEN_HEIGHT / 2.0 + dY + randY,
-					cam.focalLength
-				);
-				rayDir = cam.WorldToCamera(rayDir);
-				Ray ray (cam.position, rayDir);
+		// cout << "Worker " << n << " progress: " << (float)(y + 1 - y1) / (float)(y2 - y1) * 100.f << "%" << endl;
+		// cout << "Worker " << n << " sampled " << s+1 << "/" << sample * sample << "\n";
+	}
 
-				// Calculate closest point intersected by the ray
-				found = Intersection::ClosestIntersection(
-					ray, primitives, pointIntersect, -1
-				);
 
-				// If found, calculate color using current quality level
-				if (found) {
-					// color += light.CalculateColor(
-					buffer[y][x].color += light.CalculateColor(
-						pointIntersect,
-						primitives,
-						0, 10, 1, 2
-					);
-				}
-				bufferCount[y][x] ++;
-			}
-			// cout << "Worker " << n << " completed a row\n";
-		}
+}
+
+/* Renders one pass over tile n, sampling the given stratum of every pixel,
+into `pass` (the tile's pixels row by row). The first hits are added to
+`hits` unless it is NULL. */
+void RenderPass(int n, FlatSquareLight& light, int sample, int stratum, vector<vec3>& pass, AOVBuffer* hits)
+{
+	int x1, x2, y1, y2;
+	accumulation.TileBounds(n, x1, y1, x2, y2);
 
-		completedBucket++;
+	vec3 rayDir;
+	bool found = false;
+	Intersection pointIntersect;
 
-		// if( SDL_MUSTLOCK( screen ) )
-		// 	SDL_LockSurface( screen );
-		// for (int y = y1; y < y2 && !toExit; y++) {
-		// 	for (int x = x1; x < x2 && !toExit; x++) {
-		// 		PutPixelSDL(screen, x, y, buffer[y][x].color / (float)(bufferCount[y][x]));
-		// 	}
-		// }
-		// if( SDL_MUSTLOCK( screen ) )
-		// 	SDL_UnlockSurface( screen );
-		//
-		// SDL_mutexP(mut);
-		// SDL_UpdateRect( screen, 0, 0, 0, 0 );
-		// SDL_mutexV(mut);
+	float dX = -0.5 + (stratum % sample) / (float) sample;
+	float dY = -0.5 + (stratum / sample) / (float) sample;
 
-		// cout << "Worker " << n << " progress: " << (float)(y + 1 - y1) / (float)(y2 - y1) * 100.f << "%" << endl;
-		// cout << "Worker " << n << " sampled " << s+1 << "/" << sample * sample << "\n";
-	}
+	// Calculate color for every pixel in bucket
+	for (int y = y1; y < y2 && !toExit; y++) {
+		for (int x = x1; x < x2 && !toExit; x++) {
+
+			double pixelBegin = HEATMAP ? Heatmap::ThreadTime() : 0;
+
+			// Calculate ray direction and create ray
+			float randX = (1.f / sample) * distribution(generator);
+			float randY = (1.f / sample) * distribution(generator);
+			rayDir = vec3(
+				x - SCREEN_WIDTH / 2.0 + dX + randX,
+				y - SCREEN_HEIGHT / 2.0 + dY + randY,
+				cam.focalLength
+			);
+			rayDir = cam.WorldToCamera(rayDir);
+			Ray ray (cam.position, rayDir);
 
+			// Calculate closest point intersected by the ray
+			found = Intersection::ClosestIntersection(
+				ray, scene, pointIntersect, -1
+			);
 
+			// If found, calculate color using current quality level
+			vec3& color = pass[(y - y1) * (x2 - x1) + (x - x1)];
+			if (found) {
+				color = light.CalculateColor(
+					pointIntersect,
+					scene,
+					0, 10, 1, 2
+				);
+			} else {
+				color = vec3(0, 0, 0);
+			}
+
+			if (hits && found) {
+				hits->Add(x, y, pointIntersect, length(pointIntersect.position - cam.position));
+			} else if (hits) {
+				hits->AddMiss(x, y);
+			}
+
+			if (HEATMAP) {
+				costBuffer[y][x] += Heatmap::ThreadTime() - pixelBegin;
+			}
+		}
+		// cout << "Worker " << n << " completed a row\n";
+	}
 }